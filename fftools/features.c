@@ -1,28 +1,51 @@
 #include "features.h"
 
-#include <netinet/in.h>
-#include <netdb.h>
-#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
 #include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <libavutil/log.h>
+#include <libavutil/avassert.h>
 #include <libavutil/avstring.h>
+#include <libavutil/bprint.h>
+#include <libavutil/fifo.h>
+#include <libavutil/hash.h>
+#include <libavutil/intreadwrite.h>
 #include <libavutil/opt.h>
-#include <libavfilter/internal.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/time.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
 
 #define MAX_HTTP_RESPONS_SIZE 1024
+#define MAX_HTTP_AUDIO_SIZE (64 << 20)
+#define TTS_IO_BUFFER_SIZE 32768
+#define TTS_FRAME_SAMPLES 1024
 
-static const int portno = 8000;
-static const char *host_addr = "192.168.3.221";
-static const char *api_push_text = "/api/gen_audio";
-static const char *api_get_audio = "/api/get_audio/";
-static const char *request_fmt = "POST %s HTTP/1.1\r\n%s\r\n\r\n%s";
+#define TTS_DEFAULT_PORT 8000
 
-int open_input(AVFormatContext **fmt_ctx, AVCodecContext **dec_ctx, int *audio_stream_index, const char *filename)
+/* keeps a send() to a connection the server has closed from raising SIGPIPE */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+int open_input(AVFormatContext **fmt_ctx, AVCodecContext **dec_ctx, int *audio_stream_index, const char *filename,
+               AVIOContext *pb)
 {
     int ret;
     AVCodec *dec;
 
+    if (pb)
+    {
+        *fmt_ctx = avformat_alloc_context();
+        if (*fmt_ctx == NULL)
+            return AVERROR(ENOMEM);
+        (*fmt_ctx)->pb = pb;
+    }
+
     if ((ret = avformat_open_input(fmt_ctx, filename, NULL, NULL)) < 0)
     {
         av_log(NULL, AV_LOG_ERROR, "Cannot open input file\n");
@@ -60,11 +83,218 @@ int open_input(AVFormatContext **fmt_ctx, AVCodecContext **dec_ctx, int *audio_s
     return 0;
 }
 
+static void tts_request_free(void *msg)
+{
+    TTSRequest *req = msg;
+    av_freep(&req->text);
+}
+
+static void tts_result_free(void *msg)
+{
+    TTSResult *res = msg;
+    int i;
+    for (i = 0; i < res->nb_frames; i++)
+        av_frame_free(&res->frames[i]);
+    av_freep(&res->frames);
+    res->nb_frames = 0;
+}
+
+static const char *const tts_stage_names[TTS_STAGE_NB] = {
+    [TTS_STAGE_QUEUE]   = "queue",
+    [TTS_STAGE_REQUEST] = "request",
+    [TTS_STAGE_FETCH]   = "fetch",
+    [TTS_STAGE_PROBE]   = "probe",
+    [TTS_STAGE_DECODE]  = "decode",
+    [TTS_STAGE_FIT]     = "fit",
+    [TTS_STAGE_MIX]     = "mix",
+    [TTS_STAGE_DELAY]   = "delay",
+};
+
+/* the timings travel with the result, the histograms are only touched by the transcode loop */
+static void tts_time_stage(TTSResult *res, enum TTSStage stage, int64_t start)
+{
+    res->stage_time[stage] += av_gettime_relative() - start;
+    res->stages |= 1 << stage;
+}
+
+static void tts_hist_add(TTSHistogram *hist, int64_t us)
+{
+    us = av_clip64(us, 0, INT_MAX);
+    hist->count++;
+    hist->sum += us;
+    hist->max = FFMAX(hist->max, us);
+    hist->bucket[us ? FFMIN(av_log2(us) + 1, TTS_HIST_BUCKETS - 1) : 0]++;
+}
+
+/* upper bound of the bucket holding the percentile, so at most twice the exact value */
+static int64_t tts_hist_percentile(const TTSHistogram *hist, int percent)
+{
+    int64_t target = (hist->count * percent + 99) / 100;
+    int64_t n = 0;
+    int i;
+
+    for (i = 0; i < TTS_HIST_BUCKETS; i++)
+    {
+        n += hist->bucket[i];
+        if (n >= target)
+            return FFMIN(INT64_C(1) << i, hist->max);
+    }
+
+    return hist->max;
+}
+
+static void tts_cache_entry_free(TTSCacheEntry **pentry)
+{
+    TTSCacheEntry *entry = *pentry;
+    int i;
+
+    if (!entry)
+        return;
+    for (i = 0; i < entry->nb_frames; i++)
+        av_frame_free(&entry->frames[i]);
+    av_freep(&entry->frames);
+    av_freep(pentry);
+}
+
+static void tts_cache_unlink(TTSCache *cache, TTSCacheEntry *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+    cache->nb_entries--;
+}
+
+static void tts_cache_push_front(TTSCache *cache, TTSCacheEntry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head)
+        cache->head->prev = entry;
+    cache->head = entry;
+    if (!cache->tail)
+        cache->tail = entry;
+    cache->nb_entries++;
+}
+
+/* the keys are hex SHA-1, their first digits are as good as any hash of them */
+static unsigned tts_cache_bucket(const TTSCache *cache, const char *key)
+{
+    unsigned h = 0;
+    int i;
+
+    for (i = 0; i < 8; i++)
+        h = (h << 4) | (key[i] <= '9' ? key[i] - '0' : (key[i] | 0x20) - 'a' + 10);
+    return h & (cache->nb_buckets - 1);
+}
+
+static void tts_cache_hash_insert(TTSCache *cache, TTSCacheEntry *entry)
+{
+    TTSCacheEntry **bucket = &cache->buckets[tts_cache_bucket(cache, entry->key)];
+
+    entry->hash_next = *bucket;
+    *bucket = entry;
+}
+
+static void tts_cache_hash_remove(TTSCache *cache, TTSCacheEntry *entry)
+{
+    TTSCacheEntry **p = &cache->buckets[tts_cache_bucket(cache, entry->key)];
+
+    while (*p && *p != entry)
+        p = &(*p)->hash_next;
+    if (*p)
+        *p = entry->hash_next;
+    entry->hash_next = NULL;
+}
+
+static TTSCacheEntry *tts_cache_find(const TTSCache *cache, const char *key)
+{
+    TTSCacheEntry *entry = cache->buckets[tts_cache_bucket(cache, key)];
+
+    while (entry && strcmp(entry->key, key))
+        entry = entry->hash_next;
+    return entry;
+}
+
 void tts_cleanup(SubTTSContext *ctx)
 {
-    avfilter_graph_free(&ctx->graph);
-    av_packet_free(&ctx->decoded_pkt);
+    int i;
+
+#if HAVE_THREADS
+    if (ctx->request_queue)
+    {
+        /* drop what has not been picked up yet and wake the idle workers */
+        av_thread_message_queue_set_err_send(ctx->request_queue, AVERROR_EOF);
+        av_thread_message_flush(ctx->request_queue);
+        av_thread_message_queue_set_err_recv(ctx->request_queue, AVERROR_EOF);
+    }
+    if (ctx->result_queue)
+        av_thread_message_queue_set_err_send(ctx->result_queue, AVERROR_EOF);
+    for (i = 0; i < ctx->nb_workers_started; i++)
+        pthread_join(ctx->workers[i].thread, NULL);
+    ctx->nb_workers_started = 0;
+    if (ctx->result_queue)
+        av_thread_message_flush(ctx->result_queue);
+#endif
+    av_thread_message_queue_free(&ctx->request_queue);
+    av_thread_message_queue_free(&ctx->result_queue);
+    for (i = 0; ctx->workers && i < ctx->nb_workers; i++)
+    {
+        avcodec_free_context(&ctx->workers[i].dec_ctx);
+        av_frame_free(&ctx->workers[i].dec_frame);
+    }
+    av_freep(&ctx->workers);
+    avcodec_free_context(&ctx->sync_worker.dec_ctx);
+    av_frame_free(&ctx->sync_worker.dec_frame);
+
+    for (i = 0; i < ctx->nb_pending; i++)
+        tts_result_free(&ctx->pending[i]);
+    av_freep(&ctx->pending);
+    ctx->nb_pending = ctx->pending_size = 0;
+    av_fifo_freep(&ctx->inflight_pts);
+
+    if (ctx->backend && ctx->backend->uninit)
+        ctx->backend->uninit(ctx);
+    ctx->backend = NULL;
+
+    for (i = 0; i < TTS_STAGE_NB; i++)
+    {
+        const TTSHistogram *hist = &ctx->hist[i];
+        if (hist->count > 0)
+            av_log(NULL, AV_LOG_INFO, "Subtitle tts %-7s: %6"PRId64" times, avg %8.2f ms, "
+                   "p50 %8.2f ms, p95 %8.2f ms, p99 %8.2f ms, max %8.2f ms\n",
+                   tts_stage_names[i], hist->count, hist->sum / 1000.0 / hist->count,
+                   tts_hist_percentile(hist, 50) / 1000.0, tts_hist_percentile(hist, 95) / 1000.0,
+                   tts_hist_percentile(hist, 99) / 1000.0, hist->max / 1000.0);
+    }
+    if (ctx->cache.nb_hits + ctx->cache.nb_misses > 0)
+        av_log(NULL, AV_LOG_INFO, "Subtitle tts cache: %d hits (%d from disk), %d misses, %d evictions\n",
+               ctx->cache.nb_hits, ctx->cache.nb_disk_hits, ctx->cache.nb_misses, ctx->cache.nb_evictions);
+    while (ctx->cache.head)
+    {
+        TTSCacheEntry *entry = ctx->cache.head;
+        tts_cache_unlink(&ctx->cache, entry);
+        tts_cache_entry_free(&entry);
+    }
+    av_freep(&ctx->cache.buckets);
+    ctx->cache.nb_buckets = 0;
+    ff_mutex_destroy(&ctx->cache.lock);
+
+    while (ff_framequeue_queued_frames(&ctx->sub_frame_fifo) > 0)
+    {
+        AVFrame *frame = ff_framequeue_take(&ctx->sub_frame_fifo);
+        av_frame_free(&frame);
+    }
     ff_framequeue_free(&ctx->sub_frame_fifo);
+    av_freep(&ctx->duck_silence);
+    av_freep(&ctx->mixdsp);
+    /* the pool goes away with the last frame still referencing it */
+    av_buffer_pool_uninit(&ctx->frame_pool);
 }
 
 int tts_config_filtercontext(AVFilterContext *filter_ctx, AVCodecContext *dec_ctx)
@@ -77,344 +307,2370 @@ int tts_config_filtercontext(AVFilterContext *filter_ctx, AVCodecContext *dec_ct
     return avfilter_init_str(filter_ctx, args);
 }
 
-int tts_init(SubTTSContext *ctx)
+#if HAVE_THREADS
+static int tts_synthesize(TTSWorker *w, const TTSRequest *reqs, TTSResult *res, int nb);
+static const TTSBackend *tts_find_backend(const char *name);
+
+static void *tts_worker(void *arg)
 {
+    TTSWorker *w = arg;
+    SubTTSContext *ctx = w->ctx;
+    TTSRequest req[TTS_MAX_BATCH + 1];
+    TTSResult res[TTS_MAX_BATCH];
+    int carry = 0, nb, i;
 
-    ctx->graph = avfilter_graph_alloc();
-    if (!ctx->graph)
+    /* req[0] is already filled when a request was carried over from the last batch */
+    while (carry || av_thread_message_queue_recv(ctx->request_queue, &req[0], 0) >= 0)
     {
-        return AVERROR(ENOMEM);
+        /* join the requests already waiting, while they start close enough to the first one */
+        carry = 0;
+        for (nb = 1; nb < ctx->batch_size; nb++)
+        {
+            if (av_thread_message_queue_recv(ctx->request_queue, &req[nb], AV_THREAD_MESSAGE_NONBLOCK) < 0)
+                break;
+            if (req[nb].pts - req[0].pts > ctx->batch_window)
+            {
+                carry = 1;
+                break;
+            }
+        }
+
+        for (i = 0; i < nb; i++)
+        {
+            res[i] = (TTSResult){.seq = req[i].seq, .pts = req[i].pts, .submit_time = req[i].submit_time};
+            tts_time_stage(&res[i], TTS_STAGE_QUEUE, req[i].submit_time);
+        }
+        if (tts_synthesize(w, req, res, nb) < 0)
+            av_log(NULL, AV_LOG_WARNING, "converting subtitle to audio failed error\n");
+
+        /* failed requests are sent too, the transcode loop waits for every sequence number */
+        for (i = 0; i < nb; i++)
+        {
+            av_freep(&req[i].text);
+            if (av_thread_message_queue_send(ctx->result_queue, &res[i], 0) < 0)
+                break;
+        }
+        if (i < nb)
+        {
+            for (; i < nb; i++)
+            {
+                av_freep(&req[i].text);
+                tts_result_free(&res[i]);
+            }
+            if (carry)
+                av_freep(&req[nb].text);
+            break;
+        }
+        if (carry)
+            req[0] = req[nb];
     }
 
-    ff_framequeue_init(&ctx->sub_frame_fifo, &ctx->graph->internal->frame_queues);
-    ctx->decoded_pkt = av_packet_alloc();
-    if (!ctx->decoded_pkt)
-    {
+    return NULL;
+}
+
+static int tts_start_workers(SubTTSContext *ctx)
+{
+    int ret, i;
+
+    ret = av_thread_message_queue_alloc(&ctx->request_queue, ctx->queue_size, sizeof(TTSRequest));
+    if (ret < 0)
+        return ret;
+    av_thread_message_queue_set_free_func(ctx->request_queue, tts_request_free);
+
+    /* room for everything that can be in flight, so a worker rarely waits on the transcode loop */
+    ret = av_thread_message_queue_alloc(&ctx->result_queue, ctx->queue_size + ctx->nb_workers * ctx->batch_size, sizeof(TTSResult));
+    if (ret < 0)
+        return ret;
+    av_thread_message_queue_set_free_func(ctx->result_queue, tts_result_free);
+
+    ctx->workers = av_calloc(ctx->nb_workers, sizeof(*ctx->workers));
+    if (!ctx->workers)
         return AVERROR(ENOMEM);
-    }
 
-    ctx->is_ready = 0;
+    for (i = 0; i < ctx->nb_workers; i++)
+    {
+        ctx->workers[i].ctx = ctx;
+        if ((ret = pthread_create(&ctx->workers[i].thread, NULL, tts_worker, &ctx->workers[i])))
+        {
+            av_log(NULL, AV_LOG_ERROR, "pthread_create failed for subtitle tts worker: %s\n", strerror(ret));
+            return AVERROR(ret);
+        }
+        ctx->nb_workers_started++;
+    }
 
     return 0;
 }
+#endif
 
-static int tts_api(const char *text, float duration, int sample_rate, char *sample_fmt, char *channel_layout, char *response)
+/* host:port, [ipv6]:port, host (default port) or unix:/path/to/socket */
+static int tts_parse_endpoint(TTSEndpoint *ep, const char *spec)
 {
-    /* first what are we going to send and where are we going to send it? */
-    struct sockaddr_in serv_addr;
-    int sockfd, bytes, sent, received, total;
+    const char *path, *colon, *bracket;
+    char *end;
 
-    /* fill in the parameters */
-    char *body = av_asprintf("{\"text\":\"%s\",\"duration\":\"%f\",\"sample_rate\":\"%d\",\"sample_fmt\":\"%s\",\"channel_layout\":\"%s\"}",
-                             text, duration, sample_rate, sample_fmt, channel_layout);
-    char port_str[10];
-    char text_len_str[10];
-    char *header;
-    char *message;
-    sprintf(port_str, "%d", portno);
-    sprintf(text_len_str, "%d", (int)strlen(body));
-    header = av_asprintf("Host: %s:%s\r\nContent-Type: application/json\r\nContent-Length: %s",
-                         host_addr, port_str, text_len_str);
-    message = av_asprintf(request_fmt, api_push_text, header, body);
-    av_freep(&header);
-    av_freep(&body);
+    ff_mutex_init(&ep->pool.lock, NULL);
+    if (!(ep->name = av_strdup(spec)))
+        return AVERROR(ENOMEM);
 
-    /* create the socket */
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0)
+    if (av_strstart(spec, "unix:", &path))
+    {
+        ep->host = av_strdup(path);
+    }
+    else
     {
-        av_log(NULL, AV_LOG_ERROR, "ERROR opening socket\n");
-        goto fail;
+        colon = strrchr(spec, ':');
+        bracket = strchr(spec, ']');
+        if (colon && (!bracket || colon > bracket))
+        {
+            ep->port = strtol(colon + 1, &end, 10);
+            if (*end || ep->port <= 0 || ep->port > 65535)
+                goto invalid;
+            ep->host = av_strndup(spec, colon - spec);
+        }
+        else
+        {
+            ep->port = TTS_DEFAULT_PORT;
+            ep->host = av_strdup(spec);
+        }
     }
+    if (!ep->host)
+        return AVERROR(ENOMEM);
+    if (!*ep->host)
+        goto invalid;
+    return 0;
+
+invalid:
+    av_log(NULL, AV_LOG_ERROR, "Invalid subtitle tts endpoint '%s'\n", spec);
+    return AVERROR(EINVAL);
+}
 
-    /* fill in the structure */
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(portno);
-    serv_addr.sin_addr.s_addr = inet_addr(host_addr);
+static int tts_parse_endpoints(SubTTSContext *ctx)
+{
+    const char *list = ctx->endpoints ? ctx->endpoints : TTS_DEFAULT_ENDPOINTS;
+    char *spec, *next, *buf;
+    int nb = 1, ret = 0;
+    const char *p;
 
-    /* connect the socket */
-    if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    for (p = list; *p; p++)
+        nb += *p == ',';
+    /* allocated once, the pool mutexes must not move */
+    buf = av_strdup(list);
+    ctx->endpoint = av_calloc(nb, sizeof(*ctx->endpoint));
+    if (!buf || !ctx->endpoint)
     {
-        av_log(NULL, AV_LOG_ERROR, "ERROR connecting\n");
-        goto fail;
+        av_free(buf);
+        return AVERROR(ENOMEM);
     }
 
-    /* send the request */
-    total = strlen(message);
-    sent = 0;
-    do
+    for (spec = av_strtok(buf, ",", &next); spec; spec = av_strtok(NULL, ",", &next))
     {
-        bytes = write(sockfd, message + sent, total - sent);
-        if (bytes < 0)
-        {
-            av_log(NULL, AV_LOG_ERROR, "ERROR writing message to socket\n");
-            return AVERROR(EIO);
-        }
-        if (bytes == 0)
+        ret = tts_parse_endpoint(&ctx->endpoint[ctx->nb_endpoints++], spec);
+        if (ret < 0)
             break;
-        sent += bytes;
-    } while (sent < total);
+    }
+    av_free(buf);
+    if (ret >= 0 && !ctx->nb_endpoints)
+    {
+        av_log(NULL, AV_LOG_ERROR, "No subtitle tts endpoint in '%s'\n", list);
+        ret = AVERROR(EINVAL);
+    }
 
-    /* receive the response */
-    total = MAX_HTTP_RESPONS_SIZE - 1;
-    received = 0;
-    do
+    return ret;
+}
+
+int tts_init(SubTTSContext *ctx)
+{
+    int ret;
+
+    ff_framequeue_global_init(&ctx->frame_queues);
+    ff_framequeue_init(&ctx->sub_frame_fifo, &ctx->frame_queues);
+
+    ctx->is_ready = 0;
+    ctx->sample_offset_s = 0;
+    ctx->sample_offset_a = 0;
+    ctx->next_seq = 0;
+    ctx->deliver_seq = 0;
+    ctx->gain = 1.0f;
+    ff_mutex_init(&ctx->cache.lock, NULL);
+    ctx->sync_worker.ctx = ctx;
+    if (ctx->cache.max_entries > 0)
     {
-        bytes = read(sockfd, response + received, total - received);
-        if (bytes < 0)
-        {
-            av_log(NULL, AV_LOG_ERROR, "ERROR reading response from socket\n");
-            goto fail;
-        }
-        if (bytes == 0)
-            break;
-        received += bytes;
-        if (response[received - 1] == '}')
-            break;
-    } while (received < total);
+        /* fewer than two entries per bucket when full */
+        ctx->cache.nb_buckets = 1 << av_log2(FFMIN(ctx->cache.max_entries, TTS_CACHE_MAX_BUCKETS));
+        ctx->cache.buckets = av_calloc(ctx->cache.nb_buckets, sizeof(*ctx->cache.buckets));
+        if (!ctx->cache.buckets)
+            return AVERROR(ENOMEM);
+    }
 
-    if (received == total)
+    ctx->backend = tts_find_backend(ctx->backend_name);
+    if (!ctx->backend)
     {
-        av_log(NULL, AV_LOG_ERROR, "ERROR storing complete response from socket\n");
-        goto fail;
+        av_log(NULL, AV_LOG_ERROR, "Unknown subtitle tts backend '%s', use http or flite\n", ctx->backend_name);
+        return AVERROR(EINVAL);
     }
+    if (ctx->backend->init && (ret = ctx->backend->init(ctx)) < 0)
+        return ret;
+    if (ctx->queue_size <= 0)
+        ctx->queue_size = TTS_DEFAULT_QUEUE_SIZE;
+    ctx->batch_size = av_clip(ctx->batch_size, 1, TTS_MAX_BATCH);
+    /* atempo range, and never slower than the synthesized speech */
+    if (ctx->fit_tempo > 0)
+        ctx->fit_tempo = av_clipf(ctx->fit_tempo, 1.0f, 100.0f);
 
-    /* close the socket */
-    close(sockfd);
-fail:
-    av_freep(&message);
-    return AVERROR(EIO);
+#if HAVE_THREADS
+    if (ctx->nb_workers > 0)
+        return tts_start_workers(ctx);
+#else
+    ctx->nb_workers = 0;
+#endif
+
+    return 0;
 }
 
-static char *get_uri_value_from_response(const char *response)
+static int tts_conn_fd(AVIOContext *pb)
 {
-    char *ret = NULL;
-    ret = strrchr(response, '"');
-    if (!ret)
-        return NULL;
-    *ret = '\0';
-    ret = strrchr(response, '"');
-    if (!ret)
-        return NULL;
+    return (int)(intptr_t)pb->opaque;
+}
 
-    return ++ret;
+static int tts_conn_read(void *opaque, uint8_t *buf, int size)
+{
+    ssize_t n;
+
+    do
+        n = recv((int)(intptr_t)opaque, buf, size, 0);
+    while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return AVERROR(errno);
+
+    return n ? n : AVERROR_EOF;
 }
 
-int subtitle_to_audio(AVSubtitle *sub, SubTTSContext *ctx, char *out_uri)
+static int tts_conn_write(AVIOContext *pb, const char *buf, size_t size)
 {
-    int ret = 0;
-    int i;
-    float duration;
-    char *p, *ass, *response_api;
+    ssize_t n;
 
-    if (sub == NULL)
-        return AVERROR(ENOENT);
+    while (size > 0)
+    {
+        n = send(tts_conn_fd(pb), buf, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return AVERROR(errno);
+        buf += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+static void tts_conn_close(AVIOContext **pb)
+{
+    if (!*pb)
+        return;
+    close(tts_conn_fd(*pb));
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+}
 
-    duration = (float)(sub->end_display_time - sub->start_display_time) / 1000.0f; // in seconds unit
-    ass = sub->rects[0]->ass;
-    response_api = av_malloc(MAX_HTTP_RESPONS_SIZE);
-    memset(response_api, 0, MAX_HTTP_RESPONS_SIZE);
-    p = strchr(sub->rects[0]->ass, ',');
-    p++;
-    for (i = 0; i < 7; i++)
+static int tts_socket_open(const TTSEndpoint *ep)
+{
+    struct addrinfo hints = { 0 }, *ai, *cur;
+    struct sockaddr_un addr = { 0 };
+    char host[256], port[8];
+    size_t len = strlen(ep->host);
+    int fd = -1, ret;
+
+    if (!ep->port)
     {
-        if (!p)
+        if (len >= sizeof(addr.sun_path))
+            return AVERROR(ENAMETOOLONG);
+        addr.sun_family = AF_UNIX;
+        av_strlcpy(addr.sun_path, ep->host, sizeof(addr.sun_path));
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+            return AVERROR(errno);
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
         {
-            ret = AVERROR(ENOEXEC);
-            goto end;
+            ret = AVERROR(errno);
+            close(fd);
+            return ret;
         }
-        p = strchr(p, ',');
-        p++;
+        return fd;
     }
-    ass = av_strdup(p);
-    tts_api(ass, duration, ctx->sample_rate, ctx->sample_fmt, ctx->channel_layout, response_api);
-    p = get_uri_value_from_response(response_api);
-    if (p)
+
+    /* an ipv6 address is given in brackets */
+    if (len > 2 && ep->host[0] == '[' && ep->host[len - 1] == ']')
+        av_strlcpy(host, ep->host + 1, FFMIN(len - 1, sizeof(host)));
+    else
+        av_strlcpy(host, ep->host, sizeof(host));
+    snprintf(port, sizeof(port), "%d", ep->port);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((ret = getaddrinfo(host, port, &hints, &ai)))
     {
-        sprintf(out_uri, "http://%s:%d%s%s", host_addr, portno, api_get_audio, p);
+        av_log(NULL, AV_LOG_ERROR, "Cannot resolve the tts server %s: %s\n", host, gai_strerror(ret));
+        return AVERROR(EIO);
     }
-    else
+
+    ret = AVERROR(EIO);
+    for (cur = ai; cur; cur = cur->ai_next)
     {
-        ret = AVERROR(ENOENT);
+        if ((fd = socket(cur->ai_family, cur->ai_socktype, cur->ai_protocol)) < 0)
+        {
+            ret = AVERROR(errno);
+            continue;
+        }
+        if (!connect(fd, cur->ai_addr, cur->ai_addrlen))
+            break;
+        ret = AVERROR(errno);
+        close(fd);
+        fd = -1;
     }
+    freeaddrinfo(ai);
 
-end:
-    av_freep(&response_api);
-    av_freep(&ass);
-    return ret;
+    return fd >= 0 ? fd : ret;
 }
 
-AVFrame *fc_create_silent_frame(int sample_rate, int format, uint64_t channel_layout)
+static int tts_conn_open(AVIOContext **pb, const TTSEndpoint *ep)
 {
-    AVFrame *silent = NULL;
-    silent = av_frame_alloc();
-    if (!silent)
+    uint8_t *buffer;
+    int fd = tts_socket_open(ep);
+
+    if (fd < 0)
+        return fd;
+
+    /* buffered for reading the response, the request is sent on the socket directly */
+    buffer = av_malloc(TTS_IO_BUFFER_SIZE);
+    *pb = buffer ? avio_alloc_context(buffer, TTS_IO_BUFFER_SIZE, 0, (void *)(intptr_t)fd,
+                                      tts_conn_read, NULL, NULL) : NULL;
+    if (!*pb)
     {
-        return NULL;
+        av_free(buffer);
+        close(fd);
+        return AVERROR(ENOMEM);
     }
-    silent->format = format;
-    silent->sample_rate = sample_rate;
-    silent->channel_layout = channel_layout;
-    silent->channels = av_get_channel_layout_nb_channels(channel_layout);
-    silent->nb_samples = 1024;
-    if (av_frame_get_buffer(silent, 0) < 0)
+
+    return 0;
+}
+
+static AVIOContext *tts_pool_get(TTSConnectionPool *pool)
+{
+    AVIOContext *pb = NULL;
+
+    ff_mutex_lock(&pool->lock);
+    if (pool->nb_idle > 0)
+        pb = pool->idle[--pool->nb_idle];
+    ff_mutex_unlock(&pool->lock);
+
+    return pb;
+}
+
+static void tts_pool_put(TTSConnectionPool *pool, AVIOContext *pb)
+{
+    ff_mutex_lock(&pool->lock);
+    if (pool->nb_idle < TTS_MAX_IDLE_CONNECTIONS)
     {
-        av_frame_free(&silent);
-        return NULL;
+        pool->idle[pool->nb_idle++] = pb;
+        pb = NULL;
     }
-    av_samples_set_silence(silent->data, 0, silent->nb_samples,
-                           silent->channels, silent->format);
-    return silent;
+    ff_mutex_unlock(&pool->lock);
+
+    tts_conn_close(&pb);
 }
 
-#define MIX_AUDIO(name, type, type_up, min, max)                                                         \
-    static void fc_mix_frame_##name(SubTTSContext *ctx, AVFrame *frame)                                  \
-    {                                                                                                    \
-        int mix_sample, i;                                                                               \
-        AVFrame *sub_frame;                                                                              \
-        type *audio, *sub;                                                                               \
-        type_up sum;                                                                                     \
-        sub_frame = ff_framequeue_peek(&ctx->sub_frame_fifo, 0);                                         \
-        if ((frame->nb_samples - ctx->sample_offset_a) < (sub_frame->nb_samples - ctx->sample_offset_s)) \
-        {                                                                                                \
-            mix_sample = frame->nb_samples - ctx->sample_offset_a;                                       \
-        }                                                                                                \
-        else                                                                                             \
-        {                                                                                                \
-            mix_sample = sub_frame->nb_samples - ctx->sample_offset_s;                                   \
-        }                                                                                                \
-        audio = (type *)frame->data[frame->channels * ctx->sample_offset_a];                             \
-        sub = (type *)sub_frame->data[sub_frame->channels * ctx->sample_offset_s];                       \
-        for (i = 0; i < mix_sample; i++, audio++, sub++)                                                 \
-        {                                                                                                \
-            sum = (type_up)*audio + (type_up)*sub;                                                       \
-            if (sum < min)                                                                               \
-                sum = min;                                                                               \
-            if (sum > max)                                                                               \
-                sum = max;                                                                               \
-            *audio = (type)sum;                                                                          \
-        }                                                                                                \
-        ctx->sample_offset_a += mix_sample;                                                              \
-        ctx->sample_offset_s += mix_sample;                                                              \
-        if (ctx->sample_offset_a == frame->nb_samples)                                                   \
-        {                                                                                                \
-            ctx->sample_offset_a = 0;                                                                    \
-        }                                                                                                \
-        if (ctx->sample_offset_s == sub_frame->nb_samples)                                               \
-        {                                                                                                \
-            sub_frame = ff_framequeue_take(&ctx->sub_frame_fifo);                                        \
-            av_freep(&sub_frame);                                                                        \
-            ctx->sample_offset_s = 0;                                                                    \
-        }                                                                                                \
-    }
-
-MIX_AUDIO(u8, uint8_t, uint16_t, 0, UINT8_MAX)
-MIX_AUDIO(s16, int16_t, int32_t, INT16_MIN, INT16_MAX)
-MIX_AUDIO(s32, int32_t, int64_t, INT32_MIN, INT32_MAX)
-MIX_AUDIO(flt, float, float, -1.0, 1.0)
-MIX_AUDIO(dbl, double, double, -1.0, 1.0)
-
-#define MIX_AUDIO_P(name, type, type_up, min, max)                                                       \
-    static void fc_mix_frame_##name##p(SubTTSContext *ctx, AVFrame *frame)                               \
-    {                                                                                                    \
-        int mix_sample, chan, i, channels, gap;                                                          \
-        AVFrame *sub_frame;                                                                              \
-        type **audio, **sub;                                                                             \
-        type_up sum;                                                                                     \
-        gap = sizeof(type);                                                                              \
-        channels = frame->channels;                                                                      \
-        sub_frame = ff_framequeue_peek(&ctx->sub_frame_fifo, 0);                                         \
-        audio = (type **)malloc(channels * sizeof(type *));                                              \
-        sub = (type **)malloc(channels * sizeof(type *));                                                \
-        for (chan = 0; chan < channels; chan++)                                                          \
-        {                                                                                                \
-            audio[chan] = (type *)&frame->extended_data[chan][gap * ctx->sample_offset_a];               \
-            sub[chan] = (type *)&sub_frame->extended_data[chan][gap * ctx->sample_offset_s];             \
-        }                                                                                                \
-        if ((frame->nb_samples - ctx->sample_offset_a) < (sub_frame->nb_samples - ctx->sample_offset_s)) \
-        {                                                                                                \
-            mix_sample = frame->nb_samples - ctx->sample_offset_a;                                       \
-        }                                                                                                \
-        else                                                                                             \
-        {                                                                                                \
-            mix_sample = sub_frame->nb_samples - ctx->sample_offset_s;                                   \
-        }                                                                                                \
-        for (i = 0; i < mix_sample; i++)                                                                 \
-        {                                                                                                \
-            for (chan = 0; chan < channels; chan++)                                                      \
-            {                                                                                            \
-                sum = (type_up)*audio[chan] + (type_up)*sub[chan];                                       \
-                if (sum < min)                                                                           \
-                    sum = min;                                                                           \
-                if (sum > max)                                                                           \
-                    sum = max;                                                                           \
-                *audio[chan] = (type)sum;                                                                \
-                audio[chan]++;                                                                           \
-                sub[chan]++;                                                                             \
-            }                                                                                            \
-        }                                                                                                \
-        ctx->sample_offset_a += mix_sample;                                                              \
-        ctx->sample_offset_s += mix_sample;                                                              \
-        if (ctx->sample_offset_a = frame->nb_samples)                                                    \
-        {                                                                                                \
-            ctx->sample_offset_a = 0;                                                                    \
-        }                                                                                                \
-        if (ctx->sample_offset_s = sub_frame->nb_samples)                                                \
-        {                                                                                                \
-            sub_frame = ff_framequeue_take(&ctx->sub_frame_fifo);                                        \
-            av_freep(&sub_frame);                                                                        \
-            ctx->sample_offset_s = 0;                                                                    \
-        }                                                                                                \
-        free(audio);                                                                                     \
-        free(sub);                                                                                       \
-    }
-
-MIX_AUDIO_P(u8, uint8_t, uint16_t, 0, UINT8_MAX)
-MIX_AUDIO_P(s16, int16_t, int32_t, INT16_MIN, INT16_MAX)
-MIX_AUDIO_P(s32, int32_t, int64_t, INT32_MIN, INT32_MAX)
-MIX_AUDIO_P(flt, float, float, -1.0, 1.0)
-MIX_AUDIO_P(dbl, double, double, -1.0, 1.0)
+static void tts_pool_count(TTSConnectionPool *pool, int reused)
+{
+    ff_mutex_lock(&pool->lock);
+    if (reused)
+        pool->nb_reused++;
+    else
+        pool->nb_connects++;
+    ff_mutex_unlock(&pool->lock);
+}
 
-void tts_setup(SubTTSContext *ctx, AVCodecContext *prefer_codec)
+/* read one header line without its line ending, the rest of a too long line is dropped */
+static int tts_get_line(AVIOContext *pb, char *buf, int size)
 {
-    ctx->sample_rate = prefer_codec->sample_rate;
-    ctx->sample_fmt = av_get_sample_fmt_name(prefer_codec->sample_fmt);
-    ctx->channel_layout = av_get_channel_layout_name(prefer_codec->channel_layout);
+    int len = 0, c;
+
+    while ((c = avio_r8(pb)) && c != '\n')
+    {
+        if (len < size - 1)
+            buf[len++] = c;
+    }
+    if (len && buf[len - 1] == '\r')
+        len--;
+    buf[len] = 0;
+
+    return len;
+}
+
+static int tts_http_averror(int code)
+{
+    switch (code)
+    {
+    case 400: return AVERROR_HTTP_BAD_REQUEST;
+    case 401: return AVERROR_HTTP_UNAUTHORIZED;
+    case 403: return AVERROR_HTTP_FORBIDDEN;
+    case 404: return AVERROR_HTTP_NOT_FOUND;
+    }
+    if (code > 400 && code < 500)
+        return AVERROR_HTTP_OTHER_4XX;
+    if (code >= 500 && code < 600)
+        return AVERROR_HTTP_SERVER_ERROR;
+
+    return AVERROR(EIO);
+}
+
+static int tts_read_chunked(AVIOContext *pb, AVBPrint *body, size_t max_size)
+{
+    char line[64], *end;
+    int64_t size;
+    unsigned len;
+    int ret;
+
+    while (1)
+    {
+        tts_get_line(pb, line, sizeof(line));
+        if (pb->error < 0)
+            return pb->error;
+        size = strtoll(line, &end, 16);
+        if (end == line || size < 0 || size > max_size - body->len)
+            return AVERROR_INVALIDDATA;
+        if (!size)
+            break;
 
-    switch (prefer_codec->sample_fmt)
-    {
-    case AV_SAMPLE_FMT_U8:
-        ctx->fc_mix = fc_mix_frame_u8;
-        break;
-    case AV_SAMPLE_FMT_U8P:
-        ctx->fc_mix = fc_mix_frame_u8p;
-        break;
-    case AV_SAMPLE_FMT_S16:
-        ctx->fc_mix = fc_mix_frame_s16;
-        break;
-    case AV_SAMPLE_FMT_S16P:
-        ctx->fc_mix = fc_mix_frame_s16p;
-        break;
-    case AV_SAMPLE_FMT_S32:
-        ctx->fc_mix = fc_mix_frame_s32;
-        break;
-    case AV_SAMPLE_FMT_S32P:
-        ctx->fc_mix = fc_mix_frame_s32p;
-        break;
-    case AV_SAMPLE_FMT_FLT:
-        ctx->fc_mix = fc_mix_frame_flt;
-        break;
-    case AV_SAMPLE_FMT_FLTP:
-        ctx->fc_mix = fc_mix_frame_fltp;
-        break;
-    case AV_SAMPLE_FMT_DBL:
-        ctx->fc_mix = fc_mix_frame_dbl;
-        break;
-    case AV_SAMPLE_FMT_DBLP:
-        ctx->fc_mix = fc_mix_frame_dblp;
-        break;
+        len = body->len;
+        if ((ret = avio_read_to_bprint(pb, body, size)) < 0)
+            return ret;
+        if (body->len != len + size)
+            return AVERROR(EIO);
+        /* the line ending after the chunk data */
+        tts_get_line(pb, line, sizeof(line));
     }
+    /* trailers, up to the empty line */
+    while (tts_get_line(pb, line, sizeof(line)) > 0)
+        ;
+
+    return pb->error < 0 ? pb->error : 0;
+}
+
+/**
+ * A minimal HTTP/1.1 exchange on an open connection. libavformat has no
+ * public API to send another request on a keep-alive http connection, nor
+ * http over a unix socket.
+ * @return 1 if the connection can be reused, 0 if not, <0 on error
+ */
+static int tts_http_exchange(AVIOContext *pb, const TTSEndpoint *ep, const char *path,
+                             const char *post_data, AVBPrint *body, size_t max_size, char **mime_type)
+{
+    AVBPrint request;
+    char line[1024];
+    const char *p;
+    int64_t length = -1;
+    int code, chunked = 0, keep_alive = 1, ret;
+
+    av_bprint_init(&request, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&request, "%s %s HTTP/1.1\r\n", post_data ? "POST" : "GET", path);
+    if (ep->port)
+        av_bprintf(&request, "Host: %s:%d\r\n", ep->host, ep->port);
+    else
+        av_bprintf(&request, "Host: localhost\r\n");
+    if (post_data)
+        av_bprintf(&request, "Content-Type: application/json\r\nContent-Length: %zu\r\n", strlen(post_data));
+    av_bprintf(&request, "\r\n%s", post_data ? post_data : "");
+    if (!av_bprint_is_complete(&request))
+        ret = AVERROR(ENOMEM);
+    else
+        ret = tts_conn_write(pb, request.str, request.len);
+    av_bprint_finalize(&request, NULL);
+    if (ret < 0)
+        return ret;
+
+    tts_get_line(pb, line, sizeof(line));
+    if (!av_strstart(line, "HTTP/1.", &p) || sscanf(p, "%*c %d", &code) != 1)
+        return pb->error < 0 ? pb->error : AVERROR_INVALIDDATA;
+
+    while (tts_get_line(pb, line, sizeof(line)) > 0)
+    {
+        if (av_stristart(line, "Content-Length:", &p))
+        {
+            length = strtoll(p, NULL, 10);
+        }
+        else if (av_stristart(line, "Content-Type:", &p) && mime_type)
+        {
+            av_freep(mime_type);
+            *mime_type = av_strdup(p + strspn(p, " \t"));
+        }
+        else if (av_stristart(line, "Transfer-Encoding:", &p) && av_stristr(p, "chunked"))
+        {
+            chunked = 1;
+        }
+        else if (av_stristart(line, "Connection:", &p) && av_stristr(p, "close"))
+        {
+            keep_alive = 0;
+        }
+    }
+    if (pb->error < 0)
+        return pb->error;
+    if (code >= 400)
+        return tts_http_averror(code);
+
+    if (chunked)
+    {
+        ret = tts_read_chunked(pb, body, max_size);
+    }
+    else if (length < 0)
+    {
+        /* the body ends with the connection */
+        keep_alive = 0;
+        ret = avio_read_to_bprint(pb, body, max_size);
+    }
+    else if (length > max_size)
+    {
+        return AVERROR_INVALIDDATA;
+    }
+    else
+    {
+        ret = avio_read_to_bprint(pb, body, length);
+        if (ret >= 0 && body->len != length)
+            ret = AVERROR(EIO);
+    }
+
+    return ret < 0 ? ret : keep_alive;
+}
+
+/**
+ * Send one request to an endpoint and read the whole response body into body.
+ * post_data selects a POST, NULL sends a GET. A keep-alive connection is taken
+ * from the endpoint pool when one is idle, and given back once its response is
+ * consumed. If mime_type is not NULL it is set to the Content-Type of the response.
+ */
+static int tts_http_request(TTSEndpoint *ep, const char *path, const char *post_data,
+                            AVBPrint *body, size_t max_size, char **mime_type)
+{
+    AVIOContext *pb = tts_pool_get(&ep->pool);
+    int reused = !!pb;
+    int ret;
+
+    while (1)
+    {
+        if (!pb && (ret = tts_conn_open(&pb, ep)) < 0)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Cannot connect to the tts server %s: %s\n", ep->name, av_err2str(ret));
+            return ret;
+        }
+        tts_pool_count(&ep->pool, reused);
+
+        ret = tts_http_exchange(pb, ep, path, post_data, body, max_size, mime_type);
+        if (ret >= 0)
+            break;
+        tts_conn_close(&pb);
+        /* the server may have closed the idle connection, retry once on a new one */
+        if (!reused || body->len)
+            return ret;
+        av_log(NULL, AV_LOG_DEBUG, "Subtitle tts connection cannot be reused: %s\n", av_err2str(ret));
+        reused = 0;
+    }
+
+    if (ret > 0)
+        tts_pool_put(&ep->pool, pb);
+    else
+        tts_conn_close(&pb);
+    return 0;
+}
+
+static void tts_bprint_json(AVBPrint *bp, const char *str)
+{
+    for (; *str; str++)
+    {
+        switch (*str)
+        {
+        case '"':  av_bprintf(bp, "\\\""); break;
+        case '\\': av_bprintf(bp, "\\\\"); break;
+        case '\n': av_bprintf(bp, "\\n");  break;
+        case '\r': av_bprintf(bp, "\\r");  break;
+        case '\t': av_bprintf(bp, "\\t");  break;
+        default:
+            if ((unsigned char)*str < 0x20)
+                av_bprintf(bp, "\\u%04x", *str);
+            else
+                av_bprint_chars(bp, *str, 1);
+        }
+    }
+}
+
+/* several requests are sent as one JSON array, answered in the same order */
+static int tts_api(SubTTSContext *ctx, TTSEndpoint *ep, const TTSRequest *reqs, int nb,
+                   AVBPrint *response, char **mime_type)
+{
+    AVBPrint body;
+    int ret, i;
+
+    /* fill in the parameters, raw samples always come interleaved */
+    av_bprint_init(&body, 0, AV_BPRINT_SIZE_UNLIMITED);
+    if (nb > 1)
+        av_bprint_chars(&body, '[', 1);
+    for (i = 0; i < nb; i++)
+    {
+        if (i)
+            av_bprint_chars(&body, ',', 1);
+        av_bprintf(&body, "{\"text\":\"");
+        tts_bprint_json(&body, reqs[i].text);
+        av_bprintf(&body, "\",\"duration\":\"%f\",\"sample_rate\":\"%d\",\"sample_fmt\":\"%s\",\"channel_layout\":\"%s\"",
+                   reqs[i].duration, ctx->sample_rate,
+                   ctx->raw_audio ? av_get_sample_fmt_name(av_get_packed_sample_fmt(ctx->format)) : ctx->sample_fmt,
+                   ctx->channel_layout);
+        if (ctx->voice)
+        {
+            av_bprintf(&body, ",\"voice\":\"");
+            tts_bprint_json(&body, ctx->voice);
+            av_bprint_chars(&body, '"', 1);
+        }
+        if (ctx->raw_audio)
+            av_bprintf(&body, ",\"response_format\":\"raw\"");
+        av_bprintf(&body, "}");
+    }
+    if (nb > 1)
+        av_bprint_chars(&body, ']', 1);
+    if (!av_bprint_is_complete(&body))
+    {
+        av_bprint_finalize(&body, NULL);
+        return AVERROR(ENOMEM);
+    }
+
+    ret = tts_http_request(ep, ctx->api_gen ? ctx->api_gen : TTS_DEFAULT_API_GEN, body.str, response,
+                           ctx->raw_audio ? MAX_HTTP_AUDIO_SIZE : MAX_HTTP_RESPONS_SIZE * nb, mime_type);
+    av_bprint_finalize(&body, NULL);
+
+    return ret;
+}
+
+static char *get_uri_value_from_response(const char *response)
+{
+    char *ret = NULL;
+    ret = strrchr(response, '"');
+    if (!ret)
+        return NULL;
+    *ret = '\0';
+    ret = strrchr(response, '"');
+    if (!ret)
+        return NULL;
+
+    return ++ret;
+}
+
+static int tts_audio_path(SubTTSContext *ctx, char *response, char *path, size_t size)
+{
+    char *p = get_uri_value_from_response(response);
+    if (!p)
+        return AVERROR(ENOENT);
+
+    snprintf(path, size, "%s%s", ctx->api_get ? ctx->api_get : TTS_DEFAULT_API_GET, p);
+    return 0;
+}
+
+/**
+ * Append the text of an ASS dialog event, as in AVSubtitleRect.ass, to buf.
+ * Override blocks are dropped, line breaks and hard spaces become spaces.
+ */
+static void tts_ass_text(AVBPrint *buf, const char *dialog)
+{
+    const char *p = dialog;
+    int i;
+
+    /* ReadOrder, Layer, Style, Name, MarginL, MarginR, MarginV, Effect, Text */
+    for (i = 0; i < 8; i++)
+    {
+        p = strchr(p, ',');
+        if (!p)
+            return;
+        p++;
+    }
+
+    while (*p)
+    {
+        if (*p == '{')
+        {
+            p += strcspn(p, "}");
+            if (*p)
+                p++;
+        }
+        else if (p[0] == '\\' && (p[1] == 'N' || p[1] == 'n' || p[1] == 'h'))
+        {
+            av_bprint_chars(buf, ' ', 1);
+            p += 2;
+        }
+        else
+            av_bprint_chars(buf, *p++, 1);
+    }
+}
+
+/**
+ * Collect the spoken text of all rects, with the override codes and line
+ * breaks of ASS dialogs stripped and runs of white space collapsed.
+ */
+static char *tts_dialog_text(AVSubtitle *sub)
+{
+    AVBPrint buf, text;
+    char *str;
+    const char *p;
+    int i;
+
+    av_bprint_init(&buf, 0, AV_BPRINT_SIZE_UNLIMITED);
+    for (i = 0; i < sub->num_rects; i++)
+    {
+        AVSubtitleRect *rect = sub->rects[i];
+
+        if (rect->ass)
+            tts_ass_text(&buf, rect->ass);
+        else if (rect->text)
+            av_bprintf(&buf, "%s", rect->text);
+        av_bprint_chars(&buf, ' ', 1);
+    }
+
+    av_bprint_init(&text, 0, AV_BPRINT_SIZE_UNLIMITED);
+    for (p = buf.str; *p; p++)
+    {
+        if (av_isspace(*p))
+        {
+            if (text.len && !av_isspace(text.str[text.len - 1]))
+                av_bprint_chars(&text, ' ', 1);
+        }
+        else
+            av_bprint_chars(&text, *p, 1);
+    }
+    if (text.len && text.str[text.len - 1] == ' ')
+        text.str[--text.len] = 0;
+    av_bprint_finalize(&buf, NULL);
+
+    if (!text.len || !av_bprint_is_complete(&text))
+    {
+        av_bprint_finalize(&text, NULL);
+        return NULL;
+    }
+    av_bprint_finalize(&text, &str);
+    return str;
+}
+
+static int tts_add_frame(TTSResult *res, AVFrame *frame)
+{
+    AVFrame **frames = av_realloc_array(res->frames, res->nb_frames + 1, sizeof(*res->frames));
+    if (!frames)
+        return AVERROR(ENOMEM);
+    res->frames = frames;
+    res->frames[res->nb_frames++] = frame;
+    return 0;
+}
+
+/* the mixer adds the samples as they are, it cannot convert */
+static int tts_frame_mixable(const SubTTSContext *ctx, const AVFrame *frame)
+{
+    return frame->format == ctx->format && frame->channels == ctx->channels &&
+           frame->sample_rate == ctx->sample_rate;
+}
+
+static int tts_result_mixable(const SubTTSContext *ctx, const TTSResult *res)
+{
+    int i;
+
+    for (i = 0; i < res->nb_frames; i++)
+        if (!tts_frame_mixable(ctx, res->frames[i]))
+            return 0;
+    return 1;
+}
+
+/**
+ * Move the samples of decoded into pooled frames of at most TTS_FRAME_SAMPLES
+ * samples, the first one placed at pts. This also returns the decoder buffer
+ * at once instead of keeping it alive until the speech is played.
+ */
+static int tts_add_decoded(SubTTSContext *ctx, TTSResult *res, AVFrame *decoded, int64_t pts)
+{
+    AVFrame *frame;
+    int offset, ret;
+
+    /* speech in another format is dropped on delivery, no need to repack it */
+    if (!tts_frame_mixable(ctx, decoded))
+    {
+        if (!(frame = av_frame_alloc()))
+            return AVERROR(ENOMEM);
+        av_frame_move_ref(frame, decoded);
+        frame->pts = res->nb_frames ? AV_NOPTS_VALUE : pts;
+        if ((ret = tts_add_frame(res, frame)) < 0)
+            av_frame_free(&frame);
+        return ret;
+    }
+
+    for (offset = 0; offset < decoded->nb_samples; offset += frame->nb_samples)
+    {
+        frame = tts_get_frame(ctx, FFMIN(decoded->nb_samples - offset, TTS_FRAME_SAMPLES));
+        if (!frame)
+            return AVERROR(ENOMEM);
+        av_samples_copy(frame->extended_data, decoded->extended_data, 0, offset,
+                        frame->nb_samples, ctx->channels, ctx->format);
+
+        /* only the first frame is placed, the following ones are played back to back */
+        frame->pts = res->nb_frames ? AV_NOPTS_VALUE : pts;
+
+        if ((ret = tts_add_frame(res, frame)) < 0)
+        {
+            av_frame_free(&frame);
+            return ret;
+        }
+    }
+    av_frame_unref(decoded);
+
+    return 0;
+}
+
+static int tts_decode_packet(TTSWorker *w, AVCodecContext *dec_ctx, AVPacket *packet, TTSResult *res,
+                             int64_t pts, AVRational time_base)
+{
+    int ret;
+
+    if (!w->dec_frame && !(w->dec_frame = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+
+    ret = avcodec_send_packet(dec_ctx, packet);
+    if (ret < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "%s: Error while sending a packet to the decoder\n", __func__);
+        return ret;
+    }
+
+    while (1)
+    {
+        AVFrame *frame = w->dec_frame;
+        int64_t frame_pts;
+
+        ret = avcodec_receive_frame(dec_ctx, frame);
+        if (ret < 0)
+        {
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+                return 0;
+            av_log(NULL, AV_LOG_ERROR, "%s: Error while receiving a frame from the decoder\n", __func__);
+            return ret;
+        }
+
+        frame_pts = pts + (frame->pts != AV_NOPTS_VALUE ? av_rescale_q(frame->pts, time_base, AV_TIME_BASE_Q) : 0);
+        ret = tts_add_decoded(w->ctx, res, frame, frame_pts);
+        av_frame_unref(frame);
+        if (ret < 0)
+            return ret;
+    }
+}
+
+typedef struct TTSBuffer
+{
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+} TTSBuffer;
+
+static int tts_buffer_read(void *opaque, uint8_t *buf, int buf_size)
+{
+    TTSBuffer *b = opaque;
+
+    buf_size = FFMIN(buf_size, b->size - b->pos);
+    if (!buf_size)
+        return AVERROR_EOF;
+    memcpy(buf, b->data + b->pos, buf_size);
+    b->pos += buf_size;
+
+    return buf_size;
+}
+
+/**
+ * Cut raw interleaved samples in the configured format into frames, without
+ * any demuxer or decoder. Planar formats are deinterleaved on the way.
+ */
+static int tts_read_raw(SubTTSContext *ctx, AVIOContext *pb, TTSResult *res, int64_t pts)
+{
+    int bps = av_get_bytes_per_sample(ctx->format);
+    int block_align = bps * ctx->channels;
+    int planar = av_sample_fmt_is_planar(ctx->format);
+    uint8_t *packed = NULL;
+    int ret = 0;
+
+    if (planar)
+    {
+        packed = av_malloc(TTS_FRAME_SAMPLES * block_align);
+        if (!packed)
+            return AVERROR(ENOMEM);
+    }
+
+    while (1)
+    {
+        AVFrame *frame;
+        int size, ch, i;
+
+        frame = tts_get_frame(ctx, TTS_FRAME_SAMPLES);
+        if (!frame)
+        {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+
+        size = avio_read(pb, planar ? packed : frame->data[0], frame->nb_samples * block_align);
+        if (size < block_align)
+        {
+            av_frame_free(&frame);
+            break;
+        }
+        frame->nb_samples = size / block_align;
+
+        if (planar)
+        {
+            for (ch = 0; ch < ctx->channels; ch++)
+                for (i = 0; i < frame->nb_samples; i++)
+                    memcpy(frame->extended_data[ch] + i * bps, packed + i * block_align + ch * bps, bps);
+        }
+
+        /* only the first frame is placed, the following ones are played back to back */
+        frame->pts = res->nb_frames ? AV_NOPTS_VALUE : pts;
+
+        if ((ret = tts_add_frame(res, frame)) < 0)
+        {
+            av_frame_free(&frame);
+            break;
+        }
+    }
+
+    av_freep(&packed);
+    return ret;
+}
+
+/**
+ * Return the decoder of the worker for par, reusing the one of the previous
+ * subtitle when the stream parameters did not change.
+ */
+static int tts_get_decoder(TTSWorker *w, const AVCodecParameters *par)
+{
+    AVCodecContext *dec_ctx = w->dec_ctx;
+    AVCodec *dec;
+    int ret;
+
+    if (dec_ctx &&
+        dec_ctx->codec_id == par->codec_id &&
+        dec_ctx->sample_rate == par->sample_rate &&
+        dec_ctx->channels == par->channels &&
+        dec_ctx->block_align == par->block_align &&
+        dec_ctx->bits_per_coded_sample == par->bits_per_coded_sample &&
+        dec_ctx->extradata_size == par->extradata_size &&
+        (!par->extradata_size || !memcmp(dec_ctx->extradata, par->extradata, par->extradata_size)))
+    {
+        /* drained by the previous subtitle, only its state has to go */
+        avcodec_flush_buffers(dec_ctx);
+        return 0;
+    }
+    avcodec_free_context(&w->dec_ctx);
+
+    dec = avcodec_find_decoder(par->codec_id);
+    if (!dec)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find a decoder for the received audio\n");
+        return AVERROR_DECODER_NOT_FOUND;
+    }
+
+    dec_ctx = avcodec_alloc_context3(dec);
+    if (!dec_ctx)
+        return AVERROR(ENOMEM);
+    if ((ret = avcodec_parameters_to_context(dec_ctx, par)) < 0 ||
+        (ret = avcodec_open2(dec_ctx, dec, NULL)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open audio decoder\n");
+        avcodec_free_context(&dec_ctx);
+        return ret;
+    }
+    w->dec_ctx = dec_ctx;
+
+    return 0;
+}
+
+/**
+ * Open the received audio with the configured format, skipping the probe and
+ * avformat_find_stream_info(), and decode it with the decoder of the worker.
+ */
+static int tts_open_forced(TTSWorker *w, AVFormatContext **fmt_ctx, int *stream_index, const char *uri, AVIOContext *pb)
+{
+    int ret;
+
+    *fmt_ctx = avformat_alloc_context();
+    if (!*fmt_ctx)
+        return AVERROR(ENOMEM);
+    (*fmt_ctx)->pb = pb;
+
+    if ((ret = avformat_open_input(fmt_ctx, uri, w->ctx->iformat, NULL)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open input file\n");
+        return ret;
+    }
+
+    ret = av_find_best_stream(*fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (ret < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find an audio stream in the input file\n");
+        return ret;
+    }
+    *stream_index = ret;
+
+    return tts_get_decoder(w, (*fmt_ctx)->streams[*stream_index]->codecpar);
+}
+
+static int tts_demux_decode(TTSWorker *w, AVIOContext *pb, const char *uri, TTSResult *res, int64_t pts)
+{
+    AVFormatContext *fmt_ctx = NULL;
+    AVCodecContext *own_dec_ctx = NULL;
+    AVCodecContext *dec_ctx;
+    AVPacket *packet = NULL;
+    AVRational time_base;
+    int64_t start = av_gettime_relative();
+    int stream_index = -1;
+    int ret;
+
+    if (w->ctx->iformat)
+    {
+        ret = tts_open_forced(w, &fmt_ctx, &stream_index, uri, pb);
+        dec_ctx = w->dec_ctx;
+    }
+    else
+    {
+        ret = open_input(&fmt_ctx, &own_dec_ctx, &stream_index, uri, pb);
+        dec_ctx = own_dec_ctx;
+    }
+    if (ret < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "%s: Error while open received audio fail\n", __func__);
+        goto end;
+    }
+    time_base = fmt_ctx->streams[stream_index]->time_base;
+    tts_time_stage(res, TTS_STAGE_PROBE, start);
+    start = av_gettime_relative();
+
+    packet = av_packet_alloc();
+    if (!packet)
+    {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    while (av_read_frame(fmt_ctx, packet) >= 0)
+    {
+        if (packet->stream_index == stream_index)
+            ret = tts_decode_packet(w, dec_ctx, packet, res, pts, time_base);
+        av_packet_unref(packet);
+        if (ret < 0)
+            goto end;
+    }
+    /* drain the decoder */
+    ret = tts_decode_packet(w, dec_ctx, NULL, res, pts, time_base);
+    tts_time_stage(res, TTS_STAGE_DECODE, start);
+
+end:
+    av_packet_free(&packet);
+    avcodec_free_context(&own_dec_ctx);
+    avformat_close_input(&fmt_ctx);
+    return ret;
+}
+
+/**
+ * Decode the audio held in memory. uri is NULL for a raw response in the
+ * configured format, otherwise the data is an audio file fetched from uri.
+ */
+static int tts_decode_audio(TTSWorker *w, const uint8_t *data, size_t size, const char *uri,
+                            TTSResult *res, int64_t pts)
+{
+    AVIOContext *pb;
+    TTSBuffer buffer;
+    uint8_t *io_buffer;
+    int ret;
+
+    buffer.data = data;
+    buffer.size = size;
+    buffer.pos = 0;
+
+    io_buffer = av_malloc(TTS_IO_BUFFER_SIZE);
+    if (!io_buffer)
+        return AVERROR(ENOMEM);
+    pb = avio_alloc_context(io_buffer, TTS_IO_BUFFER_SIZE, 0, &buffer, tts_buffer_read, NULL, NULL);
+    if (!pb)
+    {
+        av_freep(&io_buffer);
+        return AVERROR(ENOMEM);
+    }
+
+    if (uri)
+        ret = tts_demux_decode(w, pb, uri, res, pts);
+    else
+    {
+        int64_t start = av_gettime_relative();
+        ret = tts_read_raw(w->ctx, pb, res, pts);
+        tts_time_stage(res, TTS_STAGE_DECODE, start);
+    }
+
+    av_freep(&pb->buffer);
+    avio_context_free(&pb);
+    return ret;
+}
+
+/**
+ * Everything that changes the synthesized audio goes into the key, so equal
+ * keys can share the same speech.
+ */
+static int tts_cache_key(SubTTSContext *ctx, const TTSRequest *req, char *key)
+{
+    struct AVHashContext *hash;
+    char params[256];
+    int ret;
+
+    if ((ret = av_hash_alloc(&hash, "SHA160")) < 0)
+        return ret;
+
+    snprintf(params, sizeof(params), "%f|%d|%s|%"PRIx64, req->duration, ctx->sample_rate,
+             av_get_sample_fmt_name(ctx->format), ctx->layout);
+    if (ctx->fit_tempo > 0)
+        av_strlcatf(params, sizeof(params), "|fit %f", ctx->fit_tempo);
+    av_hash_init(hash);
+    av_hash_update(hash, (const uint8_t *)req->text, strlen(req->text) + 1);
+    if (ctx->voice)
+        av_hash_update(hash, (const uint8_t *)ctx->voice, strlen(ctx->voice));
+    /* the http keys stay those of the existing spill directories, the other
+     * backend names come after a NUL, which no voice contains */
+    if (strcmp(ctx->backend->name, "http"))
+    {
+        av_hash_update(hash, (const uint8_t *)"", 1);
+        av_hash_update(hash, (const uint8_t *)ctx->backend->name, strlen(ctx->backend->name));
+    }
+    av_hash_update(hash, (const uint8_t *)"|", 1);
+    av_hash_update(hash, (const uint8_t *)params, strlen(params));
+    av_hash_final_hex(hash, (uint8_t *)key, TTS_CACHE_KEY_SIZE);
+    av_hash_freep(&hash);
+
+    return 0;
+}
+
+/**
+ * Hand references to the cached frames over to res, placed at pts.
+ */
+static int tts_cache_copy(const TTSCacheEntry *entry, TTSResult *res, int64_t pts)
+{
+    int i, ret;
+
+    for (i = 0; i < entry->nb_frames; i++)
+    {
+        AVFrame *frame = av_frame_clone(entry->frames[i]);
+        if (!frame)
+            return AVERROR(ENOMEM);
+        if (frame->pts != AV_NOPTS_VALUE)
+            frame->pts += pts;
+        if ((ret = tts_add_frame(res, frame)) < 0)
+        {
+            av_frame_free(&frame);
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/* the spill files hold interleaved samples in the packed variant of the configured format */
+static int tts_cache_write_file(SubTTSContext *ctx, const TTSCacheEntry *entry)
+{
+    int bps = av_get_bytes_per_sample(ctx->format);
+    int planar = av_sample_fmt_is_planar(ctx->format);
+    AVIOContext *pb = NULL;
+    char *path, *tmp_path;
+    int i, ch, n, ret;
+
+    path = av_asprintf("%s/%s.pcm", ctx->cache.dir, entry->key);
+    tmp_path = av_asprintf("%s/%s.pcm.tmp", ctx->cache.dir, entry->key);
+    if (!path || !tmp_path)
+    {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    if ((ret = avio_open(&pb, tmp_path, AVIO_FLAG_WRITE)) < 0)
+        goto end;
+    for (i = 0; i < entry->nb_frames; i++)
+    {
+        AVFrame *frame = entry->frames[i];
+        if (!planar)
+        {
+            avio_write(pb, frame->data[0], frame->nb_samples * bps * ctx->channels);
+            continue;
+        }
+        for (n = 0; n < frame->nb_samples; n++)
+            for (ch = 0; ch < ctx->channels; ch++)
+                avio_write(pb, frame->extended_data[ch] + n * bps, bps);
+    }
+    ret = avio_closep(&pb);
+
+    /* renamed only once complete, so a reader never sees a partial file */
+    if (ret >= 0 && rename(tmp_path, path) < 0)
+        ret = AVERROR(errno);
+    if (ret < 0)
+        unlink(tmp_path);
+
+end:
+    av_freep(&path);
+    av_freep(&tmp_path);
+    return ret;
+}
+
+static int tts_cache_read_file(SubTTSContext *ctx, const char *key, TTSResult *res, int64_t pts)
+{
+    AVIOContext *pb = NULL;
+    char *path;
+    int ret;
+
+    path = av_asprintf("%s/%s.pcm", ctx->cache.dir, key);
+    if (!path)
+        return AVERROR(ENOMEM);
+    ret = avio_open(&pb, path, AVIO_FLAG_READ);
+    av_freep(&path);
+    if (ret < 0)
+        return ret;
+
+    ret = tts_read_raw(ctx, pb, res, pts);
+    avio_closep(&pb);
+
+    return ret;
+}
+
+static void tts_cache_count_miss(TTSCache *cache)
+{
+    ff_mutex_lock(&cache->lock);
+    cache->nb_misses++;
+    ff_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Keep references to the frames of res, with the pts made relative to the
+ * subtitle start. A key already cached keeps its entry, only moved to the
+ * front. The least recently used entries beyond the limit are dropped, or
+ * moved to the spill directory when there is one.
+ */
+static int tts_cache_put(SubTTSContext *ctx, const char *key, const TTSResult *res, int64_t pts)
+{
+    TTSCache *cache = &ctx->cache;
+    TTSCacheEntry *entry, *existing, *evicted = NULL;
+    int i;
+
+    entry = av_mallocz(sizeof(*entry));
+    if (!entry)
+        return AVERROR(ENOMEM);
+    av_strlcpy(entry->key, key, sizeof(entry->key));
+    entry->frames = av_calloc(res->nb_frames, sizeof(*entry->frames));
+    if (!entry->frames)
+    {
+        av_freep(&entry);
+        return AVERROR(ENOMEM);
+    }
+    for (i = 0; i < res->nb_frames; i++)
+    {
+        entry->frames[i] = av_frame_clone(res->frames[i]);
+        if (!entry->frames[i])
+        {
+            tts_cache_entry_free(&entry);
+            return AVERROR(ENOMEM);
+        }
+        entry->nb_frames++;
+        if (entry->frames[i]->pts != AV_NOPTS_VALUE)
+            entry->frames[i]->pts -= pts;
+    }
+
+    ff_mutex_lock(&cache->lock);
+    /* another worker may have missed on the same key, or this is a disk hit
+     * coming back: the speech is the same, the cached one only moves up */
+    if ((existing = tts_cache_find(cache, key)))
+    {
+        tts_cache_unlink(cache, existing);
+        tts_cache_push_front(cache, existing);
+        ff_mutex_unlock(&cache->lock);
+        tts_cache_entry_free(&entry);
+        return 0;
+    }
+    tts_cache_push_front(cache, entry);
+    tts_cache_hash_insert(cache, entry);
+    if (cache->nb_entries > cache->max_entries)
+    {
+        evicted = cache->tail;
+        tts_cache_unlink(cache, evicted);
+        tts_cache_hash_remove(cache, evicted);
+        cache->nb_evictions++;
+    }
+    ff_mutex_unlock(&cache->lock);
+
+    /* written outside of the lock, the entry is no longer reachable */
+    if (evicted && cache->dir && tts_cache_write_file(ctx, evicted) < 0)
+        av_log(NULL, AV_LOG_WARNING, "Cannot spill subtitle tts audio to %s\n", cache->dir);
+    tts_cache_entry_free(&evicted);
+
+    return 0;
+}
+
+/**
+ * Look the speech up in memory, then in the spill directory.
+ * Returns 1 and fills res on a hit, 0 on a miss.
+ */
+static int tts_cache_get(SubTTSContext *ctx, const char *key, TTSResult *res, int64_t pts)
+{
+    TTSCache *cache = &ctx->cache;
+    TTSCacheEntry *entry;
+    int ret = 0;
+
+    ff_mutex_lock(&cache->lock);
+    entry = tts_cache_find(cache, key);
+    if (entry)
+    {
+        tts_cache_unlink(cache, entry);
+        tts_cache_push_front(cache, entry);
+        ret = tts_cache_copy(entry, res, pts);
+        if (ret >= 0)
+        {
+            cache->nb_hits++;
+            ret = 1;
+        }
+    }
+    ff_mutex_unlock(&cache->lock);
+
+    if (ret || !cache->dir)
+        return ret;
+
+    if (tts_cache_read_file(ctx, key, res, pts) >= 0 && res->nb_frames > 0)
+    {
+        ff_mutex_lock(&cache->lock);
+        cache->nb_hits++;
+        cache->nb_disk_hits++;
+        ff_mutex_unlock(&cache->lock);
+        /* back into memory, it is likely to be repeated again */
+        tts_cache_put(ctx, key, res, pts);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Pick the endpoint of the next request, round robin or the one with the
+ * fewest requests in flight, and count the request on it until
+ * tts_endpoint_release().
+ */
+static TTSEndpoint *tts_endpoint_acquire(SubTTSContext *ctx)
+{
+    TTSEndpoint *ep;
+    int best, i;
+
+    ff_mutex_lock(&ctx->endpoint_lock);
+    best = ctx->next_endpoint;
+    if (ctx->balance_mode == TTS_BALANCE_LEAST_OUTSTANDING)
+    {
+        /* scanned from the round robin position, so ties are spread too */
+        for (i = 1; i < ctx->nb_endpoints; i++)
+        {
+            int idx = (ctx->next_endpoint + i) % ctx->nb_endpoints;
+            if (ctx->endpoint[idx].outstanding < ctx->endpoint[best].outstanding)
+                best = idx;
+        }
+    }
+    ctx->next_endpoint = (best + 1) % ctx->nb_endpoints;
+    ep = &ctx->endpoint[best];
+    ep->outstanding++;
+    ff_mutex_unlock(&ctx->endpoint_lock);
+
+    return ep;
+}
+
+static void tts_endpoint_release(SubTTSContext *ctx, TTSEndpoint *ep, int64_t start, int failed)
+{
+    int64_t latency = av_gettime_relative() - start;
+
+    ff_mutex_lock(&ctx->endpoint_lock);
+    ep->outstanding--;
+    ep->nb_requests++;
+    ep->nb_errors += failed;
+    ep->total_latency += latency;
+    ep->max_latency = FFMAX(ep->max_latency, latency);
+    ff_mutex_unlock(&ctx->endpoint_lock);
+}
+
+/**
+ * Request the speech of one subtitle from the backend and decode all of it.
+ * Runs on a worker thread, it must not touch the fields owned by the transcode loop.
+ * Both round trips go to ep, the audio id is only known there.
+ */
+static int tts_synthesize_on(SubTTSContext *ctx, TTSEndpoint *ep, TTSWorker *w,
+                             const TTSRequest *req, TTSResult *res)
+{
+    AVBPrint audio;
+    char audio_path[256];
+    char *mime_type = NULL;
+    int64_t start = av_gettime_relative();
+    int ret;
+
+    av_bprint_init(&audio, 0, AV_BPRINT_SIZE_UNLIMITED);
+
+    ret = tts_api(ctx, ep, req, 1, &audio, ctx->raw_audio ? &mime_type : NULL);
+    tts_time_stage(res, TTS_STAGE_REQUEST, start);
+    if (ret < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "%s: Error while call api to convert subtitle to audio fail\n", __func__);
+        goto end;
+    }
+
+    /* a single round trip, the response body is the speech itself */
+    if (ctx->raw_audio && !av_strstart(mime_type, "application/json", NULL))
+    {
+        ret = tts_decode_audio(w, (uint8_t *)audio.str, audio.len, NULL, res, req->pts);
+        goto end;
+    }
+
+    /* otherwise the server answered with the id of the audio to fetch */
+    if ((ret = tts_audio_path(ctx, audio.str, audio_path, sizeof(audio_path))) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "%s: Error while call api to convert subtitle to audio fail\n", __func__);
+        goto end;
+    }
+    av_bprint_clear(&audio);
+
+    /* fetched over the same keep-alive connections, then demuxed from memory */
+    start = av_gettime_relative();
+    ret = tts_http_request(ep, audio_path, NULL, &audio, MAX_HTTP_AUDIO_SIZE, NULL);
+    tts_time_stage(res, TTS_STAGE_FETCH, start);
+    if (ret < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "%s: Error while fetching received audio fail\n", __func__);
+        goto end;
+    }
+    ret = tts_decode_audio(w, (uint8_t *)audio.str, audio.len, audio_path, res, req->pts);
+
+end:
+    av_freep(&mime_type);
+    av_bprint_finalize(&audio, NULL);
+    return ret;
+}
+
+/* the answer to a batch lists the audio ids in request order, as a JSON array */
+static int tts_batch_ids(char *response, char **ids, int nb)
+{
+    char *p = strchr(response, '[');
+    int i;
+
+    for (i = 0; p && i < nb; i++)
+    {
+        char *start = strchr(p, '"');
+        char *end = start ? strchr(start + 1, '"') : NULL;
+        if (!end)
+            break;
+        *end = '\0';
+        ids[i] = start + 1;
+        p = end + 1;
+    }
+
+    return i == nb ? 0 : AVERROR_INVALIDDATA;
+}
+
+/* the raw answer to a batch holds each segment after its 32 bit little endian byte count */
+static int tts_batch_raw(TTSWorker *w, const AVBPrint *audio, const TTSRequest *reqs,
+                         TTSResult **res, int nb)
+{
+    const uint8_t *p = (const uint8_t *)audio->str;
+    const uint8_t *end = p + audio->len;
+    uint32_t size;
+    int ret, i;
+
+    for (i = 0; i < nb; i++)
+    {
+        if (end - p < 4 || (size = AV_RL32(p)) > end - p - 4)
+            return AVERROR_INVALIDDATA;
+        p += 4;
+        if ((ret = tts_decode_audio(w, p, size, NULL, res[i], reqs[i].pts)) < 0)
+            return ret;
+        p += size;
+    }
+
+    return 0;
+}
+
+static int tts_synthesize_batch_on(SubTTSContext *ctx, TTSEndpoint *ep, TTSWorker *w,
+                                   const TTSRequest *reqs, TTSResult **res, int nb)
+{
+    AVBPrint response, audio;
+    char *ids[TTS_MAX_BATCH];
+    char audio_path[256];
+    char *mime_type = NULL;
+    int64_t start = av_gettime_relative();
+    int ret, i;
+
+    av_bprint_init(&response, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprint_init(&audio, 0, AV_BPRINT_SIZE_UNLIMITED);
+
+    /* every subtitle of the batch waited for the whole request */
+    ret = tts_api(ctx, ep, reqs, nb, &response, ctx->raw_audio ? &mime_type : NULL);
+    for (i = 0; i < nb; i++)
+        tts_time_stage(res[i], TTS_STAGE_REQUEST, start);
+    if (ret < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "%s: Error while call api to convert %d subtitles to audio\n", __func__, nb);
+        goto end;
+    }
+
+    if (ctx->raw_audio && !av_strstart(mime_type, "application/json", NULL))
+    {
+        ret = tts_batch_raw(w, &response, reqs, res, nb);
+        goto end;
+    }
+
+    if ((ret = tts_batch_ids(response.str, ids, nb)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "%s: Expected %d audio ids in the tts response\n", __func__, nb);
+        goto end;
+    }
+    for (i = 0; i < nb; i++)
+    {
+        snprintf(audio_path, sizeof(audio_path), "%s%s",
+                 ctx->api_get ? ctx->api_get : TTS_DEFAULT_API_GET, ids[i]);
+        av_bprint_clear(&audio);
+        start = av_gettime_relative();
+        ret = tts_http_request(ep, audio_path, NULL, &audio, MAX_HTTP_AUDIO_SIZE, NULL);
+        tts_time_stage(res[i], TTS_STAGE_FETCH, start);
+        if (ret < 0 ||
+            (ret = tts_decode_audio(w, (uint8_t *)audio.str, audio.len, audio_path, res[i], reqs[i].pts)) < 0)
+        {
+            av_log(NULL, AV_LOG_ERROR, "%s: Error while fetching received audio fail\n", __func__);
+            goto end;
+        }
+    }
+
+end:
+    av_freep(&mime_type);
+    av_bprint_finalize(&response, NULL);
+    av_bprint_finalize(&audio, NULL);
+    return ret;
+}
+
+static int tts_http_init(SubTTSContext *ctx)
+{
+    int ret;
+
+    ff_mutex_init(&ctx->endpoint_lock, NULL);
+    if ((ret = tts_parse_endpoints(ctx)) < 0)
+        return ret;
+    if (!ctx->balance || !strcmp(ctx->balance, "rr"))
+        ctx->balance_mode = TTS_BALANCE_ROUND_ROBIN;
+    else if (!strcmp(ctx->balance, "lo"))
+        ctx->balance_mode = TTS_BALANCE_LEAST_OUTSTANDING;
+    else
+    {
+        av_log(NULL, AV_LOG_ERROR, "Unknown subtitle tts balancing '%s', use rr or lo\n", ctx->balance);
+        return AVERROR(EINVAL);
+    }
+
+    if (ctx->audio_format)
+    {
+        ctx->iformat = av_find_input_format(ctx->audio_format);
+        if (!ctx->iformat)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Unknown subtitle tts audio format '%s'\n", ctx->audio_format);
+            return AVERROR(EINVAL);
+        }
+    }
+
+    return 0;
+}
+
+/* the requests of a batch all go to the same endpoint */
+static int tts_http_synthesize(TTSWorker *w, const TTSRequest *reqs, TTSResult **res, int nb)
+{
+    SubTTSContext *ctx = w->ctx;
+    TTSEndpoint *ep = tts_endpoint_acquire(ctx);
+    int64_t start = av_gettime_relative();
+    int ret;
+
+    if (nb == 1)
+        ret = tts_synthesize_on(ctx, ep, w, &reqs[0], res[0]);
+    else
+        ret = tts_synthesize_batch_on(ctx, ep, w, reqs, res, nb);
+    tts_endpoint_release(ctx, ep, start, ret < 0);
+
+    return ret;
+}
+
+static void tts_http_uninit(SubTTSContext *ctx)
+{
+    int i;
+
+    for (i = 0; i < ctx->nb_endpoints; i++)
+    {
+        TTSEndpoint *ep = &ctx->endpoint[i];
+        TTSConnectionPool *pool = &ep->pool;
+
+        if (ep->nb_requests > 0)
+            av_log(NULL, AV_LOG_INFO, "Subtitle tts %s: %d requests, %d failed, latency %.1f ms avg %.1f ms max, "
+                   "%d http requests, %d on reused connections, %d new connections\n",
+                   ep->name, ep->nb_requests, ep->nb_errors,
+                   ep->total_latency / 1000.0 / ep->nb_requests, ep->max_latency / 1000.0,
+                   pool->nb_reused + pool->nb_connects, pool->nb_reused, pool->nb_connects);
+        while (pool->nb_idle > 0)
+            tts_conn_close(&pool->idle[--pool->nb_idle]);
+        ff_mutex_destroy(&pool->lock);
+        av_freep(&ep->name);
+        av_freep(&ep->host);
+    }
+    av_freep(&ctx->endpoint);
+    ctx->nb_endpoints = 0;
+    ff_mutex_destroy(&ctx->endpoint_lock);
+}
+
+static const TTSBackend tts_http_backend = {
+    .name       = "http",
+    .init       = tts_http_init,
+    .synthesize = tts_http_synthesize,
+    .uninit     = tts_http_uninit,
+};
+
+/**
+ * flite unregisters a voice with its last filter instance, and each cue is
+ * spoken by a new one. An idle instance is kept for the lifetime of the
+ * backend, so that the voice is only loaded once.
+ */
+static int tts_flite_init(SubTTSContext *ctx)
+{
+    AVFilterContext *flite;
+    int ret;
+
+    if (!avfilter_get_by_name("flite"))
+    {
+        av_log(NULL, AV_LOG_ERROR, "The flite subtitle tts backend needs libavfilter "
+               "built with --enable-libflite\n");
+        return AVERROR_FILTER_NOT_FOUND;
+    }
+
+    ctx->flite_voice = avfilter_graph_alloc();
+    if (!ctx->flite_voice)
+        return AVERROR(ENOMEM);
+    flite = avfilter_graph_alloc_filter(ctx->flite_voice, avfilter_get_by_name("flite"), "voice");
+    if (!flite)
+        return AVERROR(ENOMEM);
+    if ((ret = av_opt_set(flite, "text", " ", AV_OPT_SEARCH_CHILDREN)) < 0 ||
+        (ctx->voice && (ret = av_opt_set(flite, "voice", ctx->voice, AV_OPT_SEARCH_CHILDREN)) < 0) ||
+        (ret = avfilter_init_str(flite, NULL)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot load the flite voice: %s\n", av_err2str(ret));
+        return ret;
+    }
+
+    return 0;
+}
+
+static void tts_flite_uninit(SubTTSContext *ctx)
+{
+    avfilter_graph_free(&ctx->flite_voice);
+}
+
+/**
+ * Speak one subtitle with the flite source filter, converted to the mixed
+ * format by the graph, straight into frames.
+ */
+static int tts_flite_speak(TTSWorker *w, const TTSRequest *req, TTSResult *res)
+{
+    SubTTSContext *ctx = w->ctx;
+    AVFilterGraph *graph;
+    AVFilterContext *src, *format, *sink;
+    char args[256];
+    int64_t start = av_gettime_relative();
+    int ret;
+
+    if (!w->dec_frame && !(w->dec_frame = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+    graph = avfilter_graph_alloc();
+    if (!graph)
+        return AVERROR(ENOMEM);
+    /* the workers already run in parallel */
+    graph->nb_threads = 1;
+
+    src = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("flite"), "flite");
+    if (!src)
+    {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = av_opt_set(src, "text", req->text, AV_OPT_SEARCH_CHILDREN)) < 0 ||
+        (ctx->voice && (ret = av_opt_set(src, "voice", ctx->voice, AV_OPT_SEARCH_CHILDREN)) < 0) ||
+        (ret = av_opt_set_int(src, "nb_samples", TTS_FRAME_SAMPLES, AV_OPT_SEARCH_CHILDREN)) < 0 ||
+        (ret = avfilter_init_str(src, NULL)) < 0)
+        goto end;
+
+    snprintf(args, sizeof(args), "sample_fmts=%s:sample_rates=%d:channel_layouts=0x%"PRIx64,
+             ctx->sample_fmt, ctx->sample_rate, ctx->layout);
+    if ((ret = avfilter_graph_create_filter(&format, avfilter_get_by_name("aformat"), "format",
+                                            args, NULL, graph)) < 0 ||
+        (ret = avfilter_graph_create_filter(&sink, avfilter_get_by_name("abuffersink"), "sink",
+                                            NULL, NULL, graph)) < 0 ||
+        (ret = avfilter_link(src, 0, format, 0)) < 0 ||
+        (ret = avfilter_link(format, 0, sink, 0)) < 0 ||
+        (ret = avfilter_graph_config(graph, NULL)) < 0)
+        goto end;
+
+    while ((ret = av_buffersink_get_frame(sink, w->dec_frame)) >= 0)
+    {
+        ret = tts_add_decoded(ctx, res, w->dec_frame, req->pts);
+        av_frame_unref(w->dec_frame);
+        if (ret < 0)
+            goto end;
+    }
+    if (ret == AVERROR_EOF)
+        ret = 0;
+
+end:
+    /* synthesis and conversion happen in the same graph, all of it is the request */
+    tts_time_stage(res, TTS_STAGE_REQUEST, start);
+    if (ret < 0)
+        av_log(NULL, AV_LOG_ERROR, "%s: Error while synthesizing with flite: %s\n", __func__, av_err2str(ret));
+    avfilter_graph_free(&graph);
+    return ret;
+}
+
+static int tts_flite_synthesize(TTSWorker *w, const TTSRequest *reqs, TTSResult **res, int nb)
+{
+    int ret, i;
+
+    for (i = 0; i < nb; i++)
+        if ((ret = tts_flite_speak(w, &reqs[i], res[i])) < 0)
+            return ret;
+
+    return 0;
+}
+
+static const TTSBackend tts_flite_backend = {
+    .name       = "flite",
+    .init       = tts_flite_init,
+    .synthesize = tts_flite_synthesize,
+    .uninit     = tts_flite_uninit,
+};
+
+static const TTSBackend *const tts_backends[] = {
+    &tts_http_backend,
+    &tts_flite_backend,
+    NULL
+};
+
+/* NULL selects the first backend */
+static const TTSBackend *tts_find_backend(const char *name)
+{
+    int i;
+
+    for (i = 0; tts_backends[i]; i++)
+        if (!name || !strcmp(name, tts_backends[i]->name))
+            return tts_backends[i];
+
+    return NULL;
+}
+
+/**
+ * Speed the speech of req up with atempo so that it ends with its cue, by at
+ * most fit_tempo. What still overruns the cue is faded out and cut, so the
+ * next cue never starts late. Shorter speech is left as it is, the gap after
+ * it is silence anyway.
+ */
+static int tts_fit_duration(TTSWorker *w, const TTSRequest *req, TTSResult *res)
+{
+    SubTTSContext *ctx = w->ctx;
+    int64_t window = llrint(req->duration * ctx->sample_rate);
+    int64_t nb_samples = 0, pts, start;
+    TTSResult fitted = { 0 };
+    AVFilterGraph *graph = NULL;
+    AVFilterContext *src, *sink, *last;
+    char args[256], fade[128] = "";
+    double tempo;
+    int ret, i;
+
+    /* speech in another format is dropped on delivery */
+    if (!tts_result_mixable(ctx, res))
+        return 0;
+    for (i = 0; i < res->nb_frames; i++)
+        nb_samples += res->frames[i]->nb_samples;
+    if (window <= 0 || nb_samples <= window)
+        return 0;
+
+    start = av_gettime_relative();
+    pts = res->frames[0]->pts;
+    tempo = FFMIN((double)nb_samples / window, ctx->fit_tempo);
+    if (nb_samples / tempo > window + 1)
+        snprintf(fade, sizeof(fade), "t=out:st=%f:d=%f", FFMAX(req->duration - 0.05, 0), FFMIN(req->duration, 0.05));
+
+    if (!w->dec_frame && !(w->dec_frame = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+    graph = avfilter_graph_alloc();
+    if (!graph)
+        return AVERROR(ENOMEM);
+    graph->nb_threads = 1;
+
+    snprintf(args, sizeof(args), "time_base=1/%d:sample_rate=%d:sample_fmt=%s:channel_layout=0x%"PRIx64,
+             ctx->sample_rate, ctx->sample_rate, ctx->sample_fmt, ctx->layout);
+    if ((ret = avfilter_graph_create_filter(&src, avfilter_get_by_name("abuffer"), "src",
+                                            args, NULL, graph)) < 0 ||
+        (ret = avfilter_graph_create_filter(&sink, avfilter_get_by_name("abuffersink"), "sink",
+                                            NULL, NULL, graph)) < 0)
+        goto end;
+    last = src;
+    {
+        /* back to the mixed format, atempo only takes packed samples */
+        const char *chain[][2] = {
+            { "atempo",  NULL },
+            { "afade",   fade },
+            { "atrim",   NULL },
+            { "aformat", NULL },
+        };
+        char tempo_args[32], trim_args[64], format_args[128];
+
+        snprintf(tempo_args, sizeof(tempo_args), "%f", tempo);
+        snprintf(trim_args, sizeof(trim_args), "end_sample=%"PRId64, window);
+        snprintf(format_args, sizeof(format_args), "sample_fmts=%s", ctx->sample_fmt);
+        chain[0][1] = tempo_args;
+        chain[2][1] = trim_args;
+        chain[3][1] = format_args;
+
+        for (i = 0; i < FF_ARRAY_ELEMS(chain); i++)
+        {
+            AVFilterContext *filter;
+
+            if (!*chain[i][1])
+                continue;
+            if ((ret = avfilter_graph_create_filter(&filter, avfilter_get_by_name(chain[i][0]), chain[i][0],
+                                                    chain[i][1], NULL, graph)) < 0 ||
+                (ret = avfilter_link(last, 0, filter, 0)) < 0)
+                goto end;
+            last = filter;
+        }
+    }
+    if ((ret = avfilter_link(last, 0, sink, 0)) < 0 ||
+        (ret = avfilter_graph_config(graph, NULL)) < 0)
+        goto end;
+
+    /* the clip is fed from 0, the first frame carries its placement */
+    for (i = 0, nb_samples = 0; i < res->nb_frames; i++)
+    {
+        res->frames[i]->pts = nb_samples;
+        nb_samples += res->frames[i]->nb_samples;
+        if ((ret = av_buffersrc_add_frame_flags(src, res->frames[i], AV_BUFFERSRC_FLAG_KEEP_REF)) < 0)
+            goto end;
+    }
+    if ((ret = av_buffersrc_add_frame(src, NULL)) < 0)
+        goto end;
+
+    while ((ret = av_buffersink_get_frame(sink, w->dec_frame)) >= 0)
+    {
+        ret = tts_add_decoded(ctx, &fitted, w->dec_frame, pts);
+        av_frame_unref(w->dec_frame);
+        if (ret < 0)
+            goto end;
+    }
+    if (ret == AVERROR_EOF)
+        ret = 0;
+
+end:
+    avfilter_graph_free(&graph);
+    tts_time_stage(res, TTS_STAGE_FIT, start);
+    if (ret < 0)
+    {
+        av_log(NULL, AV_LOG_WARNING, "Cannot fit the subtitle speech in %.3f s: %s\n",
+               req->duration, av_err2str(ret));
+        tts_result_free(&fitted);
+        /* unfitted, but still placed */
+        for (i = 1; i < res->nb_frames; i++)
+            res->frames[i]->pts = AV_NOPTS_VALUE;
+        res->frames[0]->pts = pts;
+        return 0;
+    }
+    /* only the speech is replaced, the timings and the placement stay */
+    tts_result_free(res);
+    res->frames    = fitted.frames;
+    res->nb_frames = fitted.nb_frames;
+    return 0;
+}
+
+/**
+ * Synthesize nb requests into res. The ones missing from the cache go to the
+ * backend together, so that it can batch them.
+ */
+static int tts_synthesize(TTSWorker *w, const TTSRequest *reqs, TTSResult *res, int nb)
+{
+    SubTTSContext *ctx = w->ctx;
+    TTSRequest miss[TTS_MAX_BATCH];
+    TTSResult *miss_res[TTS_MAX_BATCH];
+    char key[TTS_MAX_BATCH][TTS_CACHE_KEY_SIZE];
+    int nb_miss = 0, ret, i;
+
+    for (i = 0; i < nb; i++)
+    {
+        if (ctx->cache.max_entries > 0)
+        {
+            if ((ret = tts_cache_key(ctx, &reqs[i], key[nb_miss])) < 0)
+                return ret;
+            if ((ret = tts_cache_get(ctx, key[nb_miss], &res[i], reqs[i].pts)) < 0)
+                return ret;
+            res[i].cached = ret > 0;
+            if (ret > 0)
+                continue;
+            tts_cache_count_miss(&ctx->cache);
+        }
+        miss[nb_miss] = reqs[i];
+        miss_res[nb_miss++] = &res[i];
+    }
+    if (!nb_miss)
+        return 0;
+
+    ret = ctx->backend->synthesize(w, miss, miss_res, nb_miss);
+    for (i = 0; ret >= 0 && i < nb_miss && ctx->fit_tempo > 0; i++)
+        ret = tts_fit_duration(w, &miss[i], miss_res[i]);
+
+    /* speech the mixer would drop is not worth keeping, and could not be spilled */
+    for (i = 0; ret >= 0 && i < nb_miss && ctx->cache.max_entries > 0; i++)
+        if (miss_res[i]->nb_frames > 0 && tts_result_mixable(ctx, miss_res[i]))
+            tts_cache_put(ctx, key[i], miss_res[i], miss[i].pts);
+    return ret;
+}
+
+static void tts_stats_add(SubTTSContext *ctx, TTSResult *res)
+{
+    int64_t samples = 0;
+    int i;
+
+    tts_time_stage(res, TTS_STAGE_DELAY, res->submit_time);
+    for (i = 0; i < TTS_STAGE_NB; i++)
+        if (res->stages & (1 << i))
+            tts_hist_add(&ctx->hist[i], res->stage_time[i]);
+
+    if (!ctx->stats_pb)
+        return;
+    for (i = 0; i < res->nb_frames; i++)
+        samples += res->frames[i]->nb_samples;
+    avio_printf(ctx->stats_pb, "{\"stream\":%d,\"seq\":%"PRId64",\"pts\":%f,\"cached\":%s,\"samples\":%"PRId64,
+                ctx->stats_index, res->seq, res->pts / (double)AV_TIME_BASE,
+                res->cached ? "true" : "false", samples);
+    for (i = 0; i < TTS_STAGE_NB; i++)
+        if (res->stages & (1 << i))
+            avio_printf(ctx->stats_pb, ",\"%s_us\":%"PRId64, tts_stage_names[i], res->stage_time[i]);
+    avio_printf(ctx->stats_pb, "}\n");
+    avio_flush(ctx->stats_pb);
+}
+
+static void tts_deliver(SubTTSContext *ctx, TTSResult *res)
+{
+    int i, mismatch = 0;
+
+    tts_stats_add(ctx, res);
+
+    for (i = 0; i < res->nb_frames; i++)
+    {
+        AVFrame *frame = res->frames[i];
+
+        if (!tts_frame_mixable(ctx, frame))
+        {
+            if (!mismatch++)
+                av_log(NULL, AV_LOG_WARNING, "Subtitle tts: dropping speech in %s %dHz %d channels, "
+                       "the audio is %s %dHz %d channels\n",
+                       av_get_sample_fmt_name(frame->format), frame->sample_rate, frame->channels,
+                       ctx->sample_fmt, ctx->sample_rate, ctx->channels);
+            av_frame_free(&res->frames[i]);
+            continue;
+        }
+        /* only the first frame of a cue carries its start, as an absolute sample
+         * of the mixed audio, the others follow it back to back */
+        if (i)
+            frame->pts = AV_NOPTS_VALUE;
+        else if (frame->pts != AV_NOPTS_VALUE)
+            frame->pts = av_rescale_q(frame->pts, AV_TIME_BASE_Q, (AVRational){ 1, ctx->sample_rate });
+        if (ff_framequeue_add(&ctx->sub_frame_fifo, frame) < 0)
+            av_frame_free(&res->frames[i]);
+    }
+    av_freep(&res->frames);
+    res->nb_frames = 0;
+    ctx->deliver_seq++;
+
+    if (ctx->inflight_pts && av_fifo_size(ctx->inflight_pts) >= sizeof(int64_t))
+        av_fifo_drain(ctx->inflight_pts, sizeof(int64_t));
+}
+
+/**
+ * Make room for one more request until its result is delivered, so that
+ * nothing can fail once it is queued: a result lost on the way would stall
+ * the delivery of all the following ones.
+ */
+static int tts_reserve_inflight(SubTTSContext *ctx)
+{
+    int64_t inflight = ctx->next_seq - ctx->deliver_seq + 1;
+    int ret;
+
+    /* the results waiting for an earlier one never outnumber the requests in flight */
+    if (inflight > ctx->pending_size)
+    {
+        TTSResult *pending = av_realloc_array(ctx->pending, inflight, sizeof(*ctx->pending));
+        if (!pending)
+            return AVERROR(ENOMEM);
+        ctx->pending = pending;
+        ctx->pending_size = inflight;
+    }
+
+    if (!ctx->inflight_pts)
+    {
+        ctx->inflight_pts = av_fifo_alloc(ctx->queue_size * sizeof(int64_t));
+        if (!ctx->inflight_pts)
+            return AVERROR(ENOMEM);
+    }
+    if (av_fifo_space(ctx->inflight_pts) < sizeof(int64_t) &&
+        (ret = av_fifo_grow(ctx->inflight_pts, av_fifo_size(ctx->inflight_pts))) < 0)
+        return ret;
+
+    return 0;
+}
+
+int subtitle_to_audio(AVSubtitle *sub, SubTTSContext *ctx)
+{
+    TTSRequest req;
+    int ret = 0;
+
+    if (sub == NULL)
+        return AVERROR(ENOENT);
+
+    req.text = tts_dialog_text(sub);
+    if (!req.text)
+        return AVERROR(ENOEXEC);
+    req.duration = (float)(sub->end_display_time - sub->start_display_time) / 1000.0f; // in seconds unit
+    req.pts = sub->pts + av_rescale(sub->start_display_time, AV_TIME_BASE, 1000);
+    req.seq = ctx->next_seq;
+    req.submit_time = av_gettime_relative();
+
+#if HAVE_THREADS
+    if (ctx->request_queue)
+    {
+        /* never wait for the backend here, a full queue means it cannot keep up anyway */
+        if ((ret = tts_reserve_inflight(ctx)) < 0)
+        {
+            av_freep(&req.text);
+            return ret;
+        }
+        ret = av_thread_message_queue_send(ctx->request_queue, &req, AV_THREAD_MESSAGE_NONBLOCK);
+        if (ret < 0)
+        {
+            if (ret == AVERROR(EAGAIN))
+                av_log(NULL, AV_LOG_WARNING, "Subtitle tts queue is full (%d requests), dropping a subtitle\n",
+                       ctx->queue_size);
+            av_freep(&req.text);
+            return ret;
+        }
+        av_fifo_generic_write(ctx->inflight_pts, &req.pts, sizeof(req.pts), NULL);
+        ctx->next_seq++;
+        return 0;
+    }
+#endif
+
+    {
+        TTSResult res = {.seq = req.seq, .pts = req.pts, .submit_time = req.submit_time};
+        ret = tts_synthesize(&ctx->sync_worker, &req, &res, 1);
+        ctx->next_seq++;
+        tts_deliver(ctx, &res);
+        av_freep(&req.text);
+    }
+    return ret;
+}
+
+/* the room was reserved with the request */
+static void tts_add_pending(SubTTSContext *ctx, TTSResult *res)
+{
+    av_assert0(ctx->nb_pending < ctx->pending_size);
+    ctx->pending[ctx->nb_pending++] = *res;
+}
+
+static void tts_deliver_pending(SubTTSContext *ctx)
+{
+    int i;
+
+    /* the workers finish out of order, hand the results over by submission (= display) order */
+    for (i = 0; i < ctx->nb_pending; i++)
+    {
+        if (ctx->pending[i].seq == ctx->deliver_seq)
+        {
+            tts_deliver(ctx, &ctx->pending[i]);
+            ctx->pending[i] = ctx->pending[--ctx->nb_pending];
+            i = -1;
+        }
+    }
+}
+
+/* display time of the oldest subtitle whose speech has not been delivered yet */
+static int64_t tts_oldest_inflight(SubTTSContext *ctx)
+{
+    int64_t pts;
+
+    if (ctx->deliver_seq == ctx->next_seq || av_fifo_size(ctx->inflight_pts) < sizeof(pts))
+        return AV_NOPTS_VALUE;
+    av_fifo_generic_peek(ctx->inflight_pts, &pts, sizeof(pts), NULL);
+
+    return pts;
+}
+
+void tts_poll(SubTTSContext *ctx, int64_t pts)
+{
+    TTSResult res;
+    int64_t oldest;
+
+    if (!ctx->result_queue)
+        return;
+
+    while (av_thread_message_queue_recv(ctx->result_queue, &res, AV_THREAD_MESSAGE_NONBLOCK) >= 0)
+        tts_add_pending(ctx, &res);
+    tts_deliver_pending(ctx);
+
+    if (!ctx->sync || pts == AV_NOPTS_VALUE)
+        return;
+
+    /* the subtitles were read ahead, so waiting here is the exception rather than the rule */
+    while ((oldest = tts_oldest_inflight(ctx)) != AV_NOPTS_VALUE && oldest < pts)
+    {
+        if (av_thread_message_queue_recv(ctx->result_queue, &res, 0) < 0)
+            break;
+        tts_add_pending(ctx, &res);
+        tts_deliver_pending(ctx);
+    }
+}
+
+AVFrame *fc_create_silent_frame(int sample_rate, int format, uint64_t channel_layout)
+{
+    AVFrame *silent = NULL;
+    silent = av_frame_alloc();
+    if (!silent)
+    {
+        return NULL;
+    }
+    silent->format = format;
+    silent->sample_rate = sample_rate;
+    silent->channel_layout = channel_layout;
+    silent->channels = av_get_channel_layout_nb_channels(channel_layout);
+    silent->nb_samples = TTS_FRAME_SAMPLES;
+    if (av_frame_get_buffer(silent, 0) < 0)
+    {
+        av_frame_free(&silent);
+        return NULL;
+    }
+    av_samples_set_silence(silent->data, 0, silent->nb_samples,
+                           silent->channels, silent->format);
+    return silent;
+}
+
+AVFrame *tts_get_frame(SubTTSContext *ctx, int nb_samples)
+{
+    int planes = av_sample_fmt_is_planar(ctx->format) ? ctx->channels : 1;
+    AVFrame *frame = av_frame_alloc();
+    int i;
+
+    if (!frame)
+        return NULL;
+    frame->format = ctx->format;
+    frame->sample_rate = ctx->sample_rate;
+    frame->channel_layout = ctx->layout;
+    frame->channels = ctx->channels;
+    frame->nb_samples = nb_samples;
+
+    if (!ctx->frame_pool || nb_samples > TTS_FRAME_SAMPLES || planes > AV_NUM_DATA_POINTERS)
+    {
+        if (av_frame_get_buffer(frame, 0) < 0)
+            av_frame_free(&frame);
+        return frame;
+    }
+
+    for (i = 0; i < planes; i++)
+    {
+        frame->buf[i] = av_buffer_pool_get(ctx->frame_pool);
+        if (!frame->buf[i])
+        {
+            av_frame_free(&frame);
+            return NULL;
+        }
+        frame->data[i] = frame->buf[i]->data;
+    }
+    frame->extended_data = frame->data;
+    frame->linesize[0] = ctx->frame_linesize;
+
+    return frame;
+}
+
+/* the mix kernels take multiples of this many samples, the rest goes through a scratch buffer */
+#define TTS_MIX_ALIGN 32
+/* the ducking gain is constant over blocks of this many samples per channel */
+#define TTS_DUCK_BLOCK 32
+
+static void tts_mix_plane(SubTTSContext *ctx, uint8_t *dst, const uint8_t *src, float gain, int len)
+{
+    DECLARE_ALIGNED(32, uint8_t, tmp_dst)[TTS_MIX_ALIGN * sizeof(double)];
+    DECLARE_ALIGNED(32, uint8_t, tmp_src)[TTS_MIX_ALIGN * sizeof(double)];
+    int bps = av_get_bytes_per_sample(ctx->format);
+    int head = len & ~(TTS_MIX_ALIGN - 1);
+    int tail = (len - head) * bps;
+
+    if (head)
+    {
+        if (gain == 1.0f)
+            ctx->mixdsp->mix(dst, src, head);
+        else
+            ctx->mixdsp->mix_scaled(dst, src, gain, head);
+    }
+    if (tail)
+    {
+        memcpy(tmp_dst, dst + head * bps, tail);
+        memcpy(tmp_src, src + head * bps, tail);
+        ctx->mixdsp->mix_scaled(tmp_dst, tmp_src, gain, TTS_MIX_ALIGN);
+        memcpy(dst + head * bps, tmp_dst, tail);
+    }
+}
+
+/* move the ducking gain towards its target by one block of nb_samples */
+static float tts_duck_gain(SubTTSContext *ctx, int speech, int nb_samples)
+{
+    float target = speech ? ctx->duck_gain : 1.0f;
+    float time = speech ? ctx->duck_attack : ctx->duck_release;
+    float step = time > 0 ? (1.0f - ctx->duck_gain) * nb_samples / (time * ctx->sample_rate) : 1.0f;
+
+    if (ctx->gain > target)
+        ctx->gain = FFMAX(ctx->gain - step, target);
+    else
+        ctx->gain = FFMIN(ctx->gain + step, target);
+    return ctx->gain;
+}
+
+/**
+ * Mix nb_samples of src into frame from offset, scaling frame by the ducking
+ * gain in the same pass. src is NULL where there is no speech, frame is then
+ * only scaled while the gain is released.
+ */
+static void tts_mix_span(SubTTSContext *ctx, AVFrame *frame, int offset,
+                         uint8_t **src, int src_offset, int nb_samples)
+{
+    int bps = av_get_bytes_per_sample(ctx->format);
+    int planar = av_sample_fmt_is_planar(ctx->format);
+    int planes = planar ? frame->channels : 1;
+    int step = planar ? 1 : frame->channels;
+    int speech = !!src;
+    int blk, chan, i;
+
+    for (i = 0; i < nb_samples; i += blk)
+    {
+        float gain;
+
+        /* a settled gain covers the rest of the span at once */
+        if (ctx->gain == (speech ? ctx->duck_gain : 1.0f))
+        {
+            if (!speech)
+                return;
+            blk = nb_samples - i;
+        }
+        else
+        {
+            blk = FFMIN(TTS_DUCK_BLOCK, nb_samples - i);
+        }
+        gain = tts_duck_gain(ctx, speech, blk);
+        for (chan = 0; chan < planes; chan++)
+            tts_mix_plane(ctx, frame->extended_data[chan] + bps * step * (offset + i),
+                          speech ? src[chan] + bps * step * (src_offset + i) : ctx->duck_silence,
+                          gain, blk * step);
+    }
+}
+
+static void fc_mix_frame(SubTTSContext *ctx, AVFrame *frame)
+{
+    AVFrame *sub_frame = ff_framequeue_peek(&ctx->sub_frame_fifo, 0);
+    int mix_sample = FFMIN(frame->nb_samples - ctx->sample_offset_a,
+                           sub_frame->nb_samples - ctx->sample_offset_s);
+
+    tts_mix_span(ctx, frame, ctx->sample_offset_a,
+                 sub_frame->extended_data, ctx->sample_offset_s, mix_sample);
+
+    ctx->sample_offset_a += mix_sample;
+    ctx->sample_offset_s += mix_sample;
+    if (ctx->sample_offset_s == sub_frame->nb_samples)
+    {
+        sub_frame = ff_framequeue_take(&ctx->sub_frame_fifo);
+        av_frame_free(&sub_frame);
+        ctx->sample_offset_s = 0;
+    }
+}
+
+void tts_mix_frame(SubTTSContext *ctx, AVFrame *frame)
+{
+    int64_t start = av_gettime_relative();
+
+    ctx->sample_offset_a = 0;
+    while (ctx->sample_offset_a < frame->nb_samples &&
+           ff_framequeue_queued_frames(&ctx->sub_frame_fifo) > 0)
+    {
+        AVFrame *speech = ff_framequeue_peek(&ctx->sub_frame_fifo, 0);
+
+        /* a cue starts at its own sample, possibly inside this frame; one
+         * running late is mixed at once */
+        if (!ctx->sample_offset_s && speech->pts != AV_NOPTS_VALUE && frame->pts != AV_NOPTS_VALUE)
+        {
+            int64_t start = speech->pts - frame->pts;
+
+            if (start >= frame->nb_samples)
+                break;
+            if (start > ctx->sample_offset_a)
+            {
+                /* the gap before it only releases the ducking, in place */
+                tts_mix_span(ctx, frame, ctx->sample_offset_a, NULL, 0, start - ctx->sample_offset_a);
+                ctx->sample_offset_a = start;
+            }
+        }
+        ctx->fc_mix(ctx, frame);
+    }
+
+    /* release the ducking over whatever the speech did not cover */
+    if (ctx->sample_offset_a < frame->nb_samples)
+        tts_mix_span(ctx, frame, ctx->sample_offset_a, NULL, 0,
+                     frame->nb_samples - ctx->sample_offset_a);
+    ctx->sample_offset_a = 0;
+
+    tts_hist_add(&ctx->hist[TTS_STAGE_MIX], av_gettime_relative() - start);
+}
+
+void tts_print_stats(SubTTSContext *ctx, AVBPrint *buf)
+{
+    const TTSHistogram *delay = &ctx->hist[TTS_STAGE_DELAY];
+
+    if (!delay->count)
+        return;
+    av_bprintf(buf, " tts=%"PRId64" delay=%.0f/%.0fms", delay->count,
+               tts_hist_percentile(delay, 50) / 1000.0, tts_hist_percentile(delay, 95) / 1000.0);
+}
+
+void tts_setup(SubTTSContext *ctx, AVCodecContext *prefer_codec)
+{
+    ctx->sample_rate = prefer_codec->sample_rate;
+    ctx->sample_fmt = av_get_sample_fmt_name(prefer_codec->sample_fmt);
+    ctx->channel_layout = av_get_channel_layout_name(prefer_codec->channel_layout);
+    ctx->format = prefer_codec->sample_fmt;
+    ctx->layout = prefer_codec->channel_layout ? prefer_codec->channel_layout
+                                               : av_get_default_channel_layout(prefer_codec->channels);
+    ctx->channels = av_get_channel_layout_nb_channels(ctx->layout);
+
+    if (!(ctx->mixdsp = av_audiomix_dsp_alloc(ctx->format)))
+    {
+        av_log(NULL, AV_LOG_ERROR, "Subtitle tts: cannot mix sample format %s\n", ctx->sample_fmt);
+        return;
+    }
+    ctx->fc_mix = fc_mix_frame;
+
+    if (av_samples_alloc(&ctx->duck_silence, NULL, 1, TTS_DUCK_BLOCK * ctx->channels,
+                         av_get_packed_sample_fmt(ctx->format), 0) < 0)
+        return;
+    av_samples_set_silence(&ctx->duck_silence, 0, TTS_DUCK_BLOCK * ctx->channels, 1,
+                           av_get_packed_sample_fmt(ctx->format));
+
+    /* without a pool the speech frames are allocated one by one */
+    if (!ctx->frame_pool &&
+        av_samples_get_buffer_size(&ctx->frame_linesize, ctx->channels, TTS_FRAME_SAMPLES, ctx->format, 0) >= 0)
+        ctx->frame_pool = av_buffer_pool_init(ctx->frame_linesize, NULL);
 
     ctx->is_ready = 1;
 }
@@ -1,25 +1,219 @@
 #ifndef FEATURES_H
 #define FEATURES_H
 
+#include "config.h"
+
 #include <libavformat/avformat.h>   /* AVFormatContext, AVCodecContext, AVSubtitle */
 #include <libavfilter/avfilter.h>   /* AVFilterGraph, AVFilterContext */
+#include <libavfilter/audiomixdsp.h> /* AVAudioMixDSPContext */
 #include <libavfilter/framequeue.h> /* FFFrameQueue */
+#include <libavutil/thread.h>       /* pthread_t */
+#include <libavutil/threadmessage.h> /* AVThreadMessageQueue */
+#include <libavutil/bprint.h>       /* AVBPrint */
+#include <libavutil/fifo.h>         /* AVFifoBuffer */
+
+#define TTS_DEFAULT_WORKERS 4     /* number of synthesis threads */
+#define TTS_DEFAULT_QUEUE_SIZE 16 /* maximum number of pending subtitle requests */
+#define TTS_MAX_IDLE_CONNECTIONS 16 /* keep-alive connections kept open to the tts server */
+#define TTS_DEFAULT_CACHE_SIZE 64 /* synthesized subtitles kept in memory */
+#define TTS_MAX_BATCH 64 /* subtitles sent in a single synthesis request */
+#define TTS_HIST_BUCKETS 32 /* power of two buckets of the stage timings, in microseconds */
+#define TTS_DEFAULT_ENDPOINTS "192.168.3.221:8000"
+#define TTS_DEFAULT_API_GEN "/api/gen_audio"
+#define TTS_DEFAULT_API_GET "/api/get_audio/"
+
+/**
+ * Stages of the speech of a subtitle, timed for the statistics.
+ */
+enum TTSStage
+{
+    TTS_STAGE_QUEUE,   /**< waiting for a worker */
+    TTS_STAGE_REQUEST, /**< synthesis request to the backend */
+    TTS_STAGE_FETCH,   /**< download of the synthesized audio */
+    TTS_STAGE_PROBE,   /**< opening the audio and its decoder */
+    TTS_STAGE_DECODE,  /**< decoding into speech frames */
+    TTS_STAGE_FIT,     /**< speeding the speech up to fit its cue */
+    TTS_STAGE_MIX,     /**< mixing into one audio frame, not per subtitle */
+    TTS_STAGE_DELAY,   /**< from the decoded subtitle to its speech ready for mixing */
+    TTS_STAGE_NB
+};
+
+typedef struct TTSHistogram
+{
+    int64_t count;
+    int64_t sum;                      /**< in microseconds */
+    int64_t max;
+    int64_t bucket[TTS_HIST_BUCKETS]; /**< bucket i counts the durations below 2^i microseconds not counted before */
+} TTSHistogram;
+
+typedef struct TTSRequest
+{
+    int64_t seq;    /**< submission order, used to deliver the results in display order */
+    int64_t pts;    /**< display start time of the subtitle in AV_TIME_BASE unit */
+    float duration; /**< display duration of the subtitle in seconds */
+    char *text;     /**< dialog text to synthesize */
+    int64_t submit_time; /**< av_gettime_relative() when the subtitle was queued */
+} TTSRequest;
+
+typedef struct TTSResult
+{
+    int64_t seq;      /**< sequence number of the originating request */
+    AVFrame **frames; /**< decoded speech frames, the first one carries the display pts */
+    int nb_frames;
+    int64_t pts;                      /**< display start time of the subtitle in AV_TIME_BASE unit */
+    int64_t submit_time;              /**< copied from the request */
+    int64_t stage_time[TTS_STAGE_NB]; /**< microseconds spent in each stage */
+    unsigned stages;                  /**< mask of the stages gone through */
+    int cached;                       /**< the speech came from the cache */
+} TTSResult;
+
+typedef struct TTSConnectionPool
+{
+    AVMutex lock;                                   /**< protects everything below, shared by the workers */
+    AVIOContext *idle[TTS_MAX_IDLE_CONNECTIONS];    /**< open http connections waiting for a request */
+    int nb_idle;
+    int nb_reused;                                  /**< requests sent on an already open connection */
+    int nb_connects;                                /**< requests which needed a new connection */
+} TTSConnectionPool;
+
+enum TTSBalance
+{
+    TTS_BALANCE_ROUND_ROBIN,       /**< each endpoint in turn */
+    TTS_BALANCE_LEAST_OUTSTANDING, /**< the endpoint with the fewest requests in flight */
+};
+
+typedef struct TTSEndpoint
+{
+    char *name;             /**< as given in the endpoint list, for logging */
+    char *host;             /**< host name, or socket path for a unix endpoint */
+    int port;               /**< tcp port, 0 for a unix socket */
+    TTSConnectionPool pool; /**< keep-alive connections to this endpoint */
+    /* below are protected by SubTTSContext.endpoint_lock */
+    int outstanding;        /**< syntheses in flight */
+    int nb_requests;        /**< finished syntheses */
+    int nb_errors;          /**< failed syntheses */
+    int64_t total_latency;  /**< sum of the synthesis latencies in microseconds */
+    int64_t max_latency;
+} TTSEndpoint;
+
+#define TTS_CACHE_KEY_SIZE 41 /* hex SHA-1 of the synthesis parameters */
+#define TTS_CACHE_MAX_BUCKETS (1 << 16) /* hash buckets of the cache index */
+
+typedef struct TTSCacheEntry
+{
+    char key[TTS_CACHE_KEY_SIZE];
+    AVFrame **frames; /**< decoded speech, pts relative to the subtitle start */
+    int nb_frames;
+    struct TTSCacheEntry *prev, *next;
+    struct TTSCacheEntry *hash_next; /**< next entry in the same hash bucket */
+} TTSCacheEntry;
+
+typedef struct TTSCache
+{
+    AVMutex lock;               /**< protects everything below, shared by the workers */
+    TTSCacheEntry *head, *tail; /**< most and least recently used entries */
+    TTSCacheEntry **buckets;    /**< the entries indexed by key, chained by hash_next */
+    int nb_buckets;             /**< a power of two */
+    int nb_entries;
+    int max_entries;            /**< entries kept in memory, 0 disables the cache */
+    char *dir;                  /**< evicted entries are spilled there when set */
+    int nb_hits;
+    int nb_disk_hits;
+    int nb_misses;
+    int nb_evictions;
+} TTSCache;
+
+typedef struct TTSWorker
+{
+    struct SubTTSContext *ctx;
+    pthread_t thread;
+    AVCodecContext *dec_ctx; /**< decoder kept open across subtitles with a forced audio format */
+    AVFrame *dec_frame;      /**< decoded frame, repacked into pooled frames */
+} TTSWorker;
+
+/**
+ * A speech synthesizer. The requests missing from the cache are handed to
+ * synthesize(), from the worker threads or the transcode loop.
+ */
+typedef struct TTSBackend
+{
+    const char *name;
+    int (*init)(struct SubTTSContext *ctx);   /**< called from tts_init(), before the workers start */
+    int (*synthesize)(TTSWorker *w, const TTSRequest *reqs, TTSResult **res, int nb);
+    void (*uninit)(struct SubTTSContext *ctx);
+} TTSBackend;
 
 typedef struct SubTTSContext
 {
     int is_ready;
-    AVFilterGraph *graph;                                      /**< filtergraph for subtitle tts */
-    FFFrameQueue sub_frame_fifo;                               /**< list of frame info for the first input */
-    AVPacket *decoded_pkt;                                     /**< packet for processing */
+    FFFrameQueueGlobal frame_queues;                           /**< shared state of the frame queues */
+    FFFrameQueue sub_frame_fifo;                               /**< queued speech, the first frame of a cue has its start sample as pts */
     int sample_offset_s;                                       /**< offset of current sample in the first frame of queue */
     int sample_offset_a;                                       /**< offset of current sample in the mixing audio frame */
     int sample_rate;                                           /**< sample rate for config */
     char *channel_layout;                                      /**< channel layout for config */
     char *sample_fmt;                                          /**< sample format for config */
+    enum AVSampleFormat format;                                /**< sample format of the mixed audio */
+    uint64_t layout;                                           /**< channel layout of the mixed audio */
+    int channels;
     void (*fc_mix)(struct SubTTSContext *ctx, AVFrame *frame); /**< function mix audio */
+    AVAudioMixDSPContext *mixdsp; /**< saturating add used by fc_mix */
+    float duck_gain;            /**< gain of the program audio under speech, 1.0 disables ducking */
+    float duck_attack;          /**< seconds to reach duck_gain once speech starts */
+    float duck_release;         /**< seconds to return to unity gain after speech */
+    float gain;                 /**< current ducking gain */
+    uint8_t *duck_silence;      /**< one block of silence, mixed in while the gain is released */
+    AVBufferPool *frame_pool;   /**< planes of the speech frames, in the configured format */
+    int frame_linesize;         /**< size of one pooled plane */
+
+    int nb_workers;                     /**< number of synthesis threads, 0 to synthesize synchronously */
+    int queue_size;                     /**< maximum number of requests waiting for a worker */
+    int batch_size;                     /**< maximum number of queued requests a worker synthesizes at once */
+    int64_t batch_window;               /**< only batch requests starting this close to the first one, in AV_TIME_BASE unit */
+    TTSWorker *workers;                 /**< synthesis threads */
+    TTSWorker sync_worker;              /**< state used when synthesizing synchronously */
+    int nb_workers_started;             /**< number of threads actually running */
+    AVThreadMessageQueue *request_queue; /**< TTSRequest from the transcode loop to the workers */
+    AVThreadMessageQueue *result_queue;  /**< TTSResult from the workers to the transcode loop */
+    int64_t next_seq;                   /**< sequence number of the next submitted request */
+    int64_t deliver_seq;                /**< sequence number of the next result to deliver */
+    TTSResult *pending;                 /**< results received ahead of deliver_seq */
+    int nb_pending;
+    int pending_size;                   /**< allocated entries of pending, reserved at submission */
+    AVFifoBuffer *inflight_pts;         /**< display time of each request not delivered yet, in order */
+    int sync;                           /**< wait for late speech instead of letting the audio run ahead */
+    float fit_tempo;                    /**< maximum speed up fitting the speech in its cue, 0 to disable */
+
+    char *backend_name;                 /**< "http" (default) or "flite" */
+    const TTSBackend *backend;
+    AVFilterGraph *flite_voice;         /**< idle flite instance keeping its voice loaded */
+
+    char *endpoints;                    /**< comma separated host:port or unix:path list */
+    char *balance;                      /**< "rr" or "lo", see enum TTSBalance */
+    char *api_gen;                      /**< path of the synthesis request */
+    char *api_get;                      /**< path prefix the audio id is appended to */
+    TTSEndpoint *endpoint;
+    int nb_endpoints;
+    int next_endpoint;                  /**< round robin position */
+    enum TTSBalance balance_mode;
+    AVMutex endpoint_lock;
+    int raw_audio;                      /**< ask for the raw samples in the gen_audio response */
+    char *audio_format;                 /**< container of the fetched audio, NULL to probe it */
+    AVInputFormat *iformat;
+    char *voice;                        /**< voice asked to the tts server, NULL for its default */
+    TTSCache cache;                     /**< already synthesized speech */
+
+    TTSHistogram hist[TTS_STAGE_NB];    /**< stage timings, owned by the transcode loop */
+    AVIOContext *stats_pb;              /**< a JSON line is written there for each subtitle when set */
+    int stats_index;                    /**< identifies the context in the JSON lines */
 } SubTTSContext;
 
-int open_input(AVFormatContext **fmt_ctx, AVCodecContext **dec_ctx, int *audio_stream_index, const char *filename);
+/**
+ * Open an audio file and its decoder. When pb is set the data is read from it
+ * instead of filename, which is then only used for logging.
+ */
+int open_input(AVFormatContext **fmt_ctx, AVCodecContext **dec_ctx, int *audio_stream_index, const char *filename,
+               AVIOContext *pb);
 
 int tts_init(SubTTSContext *ctx);
 void tts_setup(SubTTSContext *ctx, AVCodecContext *prefer_codec);
@@ -28,7 +222,31 @@ void tts_cleanup(SubTTSContext *ctx);
 int tts_config_filtercontext(AVFilterContext *filter_ctx, AVCodecContext *dec_ctx);
 
 AVFrame *fc_create_silent_frame(int sample_rate, int format, uint64_t channel_layout);
+AVFrame *tts_get_frame(SubTTSContext *ctx, int nb_samples);
+
+/**
+ * Queue a decoded subtitle for synthesis. It never waits for the backend,
+ * the speech frames are delivered later by tts_poll().
+ */
+int subtitle_to_audio(AVSubtitle *sub, SubTTSContext *ctx);
+
+/**
+ * Move the finished synthesis results into sub_frame_fifo, in display order.
+ * Must be called from the thread owning sub_frame_fifo. With ctx->sync set,
+ * it waits for the speech of every subtitle displayed before pts
+ * (AV_TIME_BASE unit).
+ */
+void tts_poll(SubTTSContext *ctx, int64_t pts);
+
+/**
+ * Mix the speech due in frame into it, ducking the frame under the speech.
+ * frame pts is in 1/sample_rate unit.
+ */
+void tts_mix_frame(SubTTSContext *ctx, AVFrame *frame);
 
-int subtitle_to_audio(AVSubtitle *sub, SubTTSContext *ctx, char *out_uri);
+/**
+ * Append a short summary of the speech delay to the -stats line in buf.
+ */
+void tts_print_stats(SubTTSContext *ctx, AVBPrint *buf);
 
 #endif /* FEATURES_H */
@@ -146,6 +146,7 @@ static int want_sdp = 1;
 
 static BenchmarkTimeStamps current_time;
 AVIOContext *progress_avio = NULL;
+AVIOContext *tts_stats_avio = NULL;
 
 static uint8_t *subtitle_out;
 
@@ -162,7 +163,18 @@ int         nb_output_files   = 0;
 FilterGraph **filtergraphs;
 int        nb_filtergraphs;
 
-SubTTSContext *sub_tts_ctx;
+/* speech of the subtitles of one stream, or of all of them, mixed into one audio stream */
+typedef struct TTSStream {
+    SubTTSContext *ctx;
+    InputStream   *sub_ist;   /* NULL for every subtitle stream */
+    InputStream   *audio_ist; /* NULL until the first decoded audio stream takes it */
+    int64_t        audio_ts;  /* end of the last audio frame mixed, in AV_TIME_BASE */
+} TTSStream;
+
+static TTSStream *tts_streams;
+static int     nb_tts_streams;
+static int64_t tts_copy_next = AV_NOPTS_VALUE; /* next [tts] sample along a copied audio stream */
+InputFilter *tts_filter;                      /* [tts] filtergraph input, if any */
 
 #if HAVE_TERMIOS_H
 
@@ -182,21 +194,34 @@ static void free_input_threads(void);
 
 static int sub2video_get_blank_frame(InputStream *ist)
 {
-    int ret;
+    int ret, y;
     AVFrame *frame = ist->sub2video.frame;
-
-    av_frame_unref(frame);
-    ist->sub2video.frame->width  = ist->dec_ctx->width  ? ist->dec_ctx->width  : ist->sub2video.w;
-    ist->sub2video.frame->height = ist->dec_ctx->height ? ist->dec_ctx->height : ist->sub2video.h;
-    ist->sub2video.frame->format = AV_PIX_FMT_RGB32;
-    if ((ret = av_frame_get_buffer(frame, 0)) < 0)
-        return ret;
-    memset(frame->data[0], 0, frame->height * frame->linesize[0]);
+    int w = ist->dec_ctx->width  ? ist->dec_ctx->width  : ist->sub2video.w;
+    int h = ist->dec_ctx->height ? ist->dec_ctx->height : ist->sub2video.h;
+
+    /* Once the filters have released the canvas, only what the previous
+       subpicture drew needs to be cleared. */
+    if (frame->buf[0] && frame->width == w && frame->height == h &&
+        av_frame_is_writable(frame)) {
+        for (y = ist->sub2video.y0; y < ist->sub2video.y1; y++)
+            memset(frame->data[0] + y * frame->linesize[0] + ist->sub2video.x0 * 4, 0,
+                   (ist->sub2video.x1 - ist->sub2video.x0) * 4);
+    } else {
+        av_frame_unref(frame);
+        frame->width  = w;
+        frame->height = h;
+        frame->format = AV_PIX_FMT_RGB32;
+        if ((ret = av_frame_get_buffer(frame, 0)) < 0)
+            return ret;
+        memset(frame->data[0], 0, frame->height * frame->linesize[0]);
+    }
+    ist->sub2video.x0 = ist->sub2video.y0 = 0;
+    ist->sub2video.x1 = ist->sub2video.y1 = 0;
     return 0;
 }
 
-static void sub2video_copy_rect(uint8_t *dst, int dst_linesize, int w, int h,
-                                AVSubtitleRect *r)
+static int sub2video_copy_rect(uint8_t *dst, int dst_linesize, int w, int h,
+                               AVSubtitleRect *r)
 {
     uint32_t *pal, *dst2;
     uint8_t *src, *src2;
@@ -204,13 +229,13 @@ static void sub2video_copy_rect(uint8_t *dst, int dst_linesize, int w, int h,
 
     if (r->type != SUBTITLE_BITMAP) {
         av_log(NULL, AV_LOG_WARNING, "sub2video: non-bitmap subtitle\n");
-        return;
+        return AVERROR(EINVAL);
     }
     if (r->x < 0 || r->x + r->w > w || r->y < 0 || r->y + r->h > h) {
         av_log(NULL, AV_LOG_WARNING, "sub2video: rectangle (%d %d %d %d) overflowing %d %d\n",
             r->x, r->y, r->w, r->h, w, h
         );
-        return;
+        return AVERROR(EINVAL);
     }
 
     dst += r->y * dst_linesize + r->x * 4;
@@ -224,6 +249,29 @@ static void sub2video_copy_rect(uint8_t *dst, int dst_linesize, int w, int h,
         dst += dst_linesize;
         src += r->linesize[0];
     }
+    return 0;
+}
+
+/* Tell overlay which part of the canvas is not transparent, so that it only
+   blends that region. This is only safe when no filter can have moved or
+   drawn pixels in between. */
+static void sub2video_set_bbox(InputStream *ist)
+{
+    AVFrame *frame = ist->sub2video.frame;
+    char box[128];
+    int i;
+
+    for (i = 0; i < ist->nb_filters; i++)
+        if (!ist->filters[i]->sub2video_bbox) {
+            av_dict_set(&frame->metadata, "lavfi.sub2video.bbox", NULL, 0);
+            return;
+        }
+    snprintf(box, sizeof(box), "%d %d %d %d %d %d",
+             ist->sub2video.x0, ist->sub2video.y0,
+             ist->sub2video.x1 - ist->sub2video.x0,
+             ist->sub2video.y1 - ist->sub2video.y0,
+             frame->width, frame->height);
+    av_dict_set(&frame->metadata, "lavfi.sub2video.bbox", box, 0);
 }
 
 static void sub2video_push_ref(InputStream *ist, int64_t pts)
@@ -270,6 +318,14 @@ void sub2video_update(InputStream *ist, int64_t heartbeat_pts, AVSubtitle *sub)
         end_pts   = INT64_MAX;
         num_rects = 0;
     }
+    /* A blank canvas is sent again as it is instead of being rebuilt. */
+    if (!num_rects && frame->buf[0] && ist->sub2video.x1 <= ist->sub2video.x0) {
+        sub2video_set_bbox(ist);
+        sub2video_push_ref(ist, pts);
+        ist->sub2video.end_pts = end_pts;
+        ist->sub2video.initialize = 0;
+        return;
+    }
     if (sub2video_get_blank_frame(ist) < 0) {
         av_log(ist->dec_ctx, AV_LOG_ERROR,
                "Impossible to get a blank canvas.\n");
@@ -277,8 +333,25 @@ void sub2video_update(InputStream *ist, int64_t heartbeat_pts, AVSubtitle *sub)
     }
     dst          = frame->data    [0];
     dst_linesize = frame->linesize[0];
-    for (i = 0; i < num_rects; i++)
-        sub2video_copy_rect(dst, dst_linesize, frame->width, frame->height, sub->rects[i]);
+    for (i = 0; i < num_rects; i++) {
+        AVSubtitleRect *r = sub->rects[i];
+
+        if (sub2video_copy_rect(dst, dst_linesize, frame->width, frame->height, r) < 0 ||
+            r->w <= 0 || r->h <= 0)
+            continue;
+        if (ist->sub2video.x1 <= ist->sub2video.x0) {
+            ist->sub2video.x0 = r->x;
+            ist->sub2video.y0 = r->y;
+            ist->sub2video.x1 = r->x + r->w;
+            ist->sub2video.y1 = r->y + r->h;
+        } else {
+            ist->sub2video.x0 = FFMIN(ist->sub2video.x0, r->x);
+            ist->sub2video.y0 = FFMIN(ist->sub2video.y0, r->y);
+            ist->sub2video.x1 = FFMAX(ist->sub2video.x1, r->x + r->w);
+            ist->sub2video.y1 = FFMAX(ist->sub2video.y1, r->y + r->h);
+        }
+    }
+    sub2video_set_bbox(ist);
     sub2video_push_ref(ist, pts);
     ist->sub2video.end_pts = end_pts;
     ist->sub2video.initialize = 0;
@@ -548,6 +621,10 @@ static void ffmpeg_cleanup(int ret)
     }
     av_freep(&filtergraphs);
 
+    for (i = 0; i < nb_tts_maps; i++)
+        av_freep(&tts_maps[i]);
+    av_freep(&tts_maps);
+
     av_freep(&subtitle_out);
 
     /* close files */
@@ -1800,6 +1877,9 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
     av_bprintf(&buf_script, "dup_frames=%d\n", nb_frames_dup);
     av_bprintf(&buf_script, "drop_frames=%d\n", nb_frames_drop);
 
+    for (i = 0; i < nb_tts_streams; i++)
+        tts_print_stats(tts_streams[i].ctx, &buf);
+
     if (speed < 0) {
         av_bprintf(&buf, " speed=N/A");
         av_bprintf(&buf_script, "speed=N/A\n");
@@ -2263,6 +2343,134 @@ static int send_frame_to_filters(InputStream *ist, AVFrame *decoded_frame)
     return ret;
 }
 
+/* bind the unmapped subtitle speech to ist, and set up the speech of ist in the format of avctx */
+static void tts_bind_streams(InputStream *ist, AVCodecContext *avctx)
+{
+    int i;
+
+    for (i = 0; i < nb_tts_streams; i++) {
+        TTSStream *ts = &tts_streams[i];
+
+        if (!ts->audio_ist)
+            ts->audio_ist = tts_filter ? tts_filter->ist : ist;
+        if (ts->audio_ist == ist && !ts->ctx->is_ready)
+            tts_setup(ts->ctx, avctx);
+    }
+}
+
+/* mix the queued speech of the subtitles mapped to ist into frame, its pts is in 1/sample_rate */
+static void tts_mix_speech(InputStream *ist, AVFrame *frame)
+{
+    int i;
+
+    for (i = 0; i < nb_tts_streams; i++) {
+        TTSStream *ts = &tts_streams[i];
+
+        if (ts->audio_ist != ist || !ts->ctx->is_ready)
+            continue;
+
+        if (frame->pts != AV_NOPTS_VALUE)
+            ts->audio_ts = av_rescale_q(frame->pts + frame->nb_samples,
+                                        (AVRational){1, frame->sample_rate}, AV_TIME_BASE_Q);
+        tts_poll(ts->ctx, ts->audio_ts);
+        tts_mix_frame(ts->ctx, frame);
+    }
+}
+
+/* send the speech covering the span of frame to the [tts] filter input */
+static int tts_send_speech(InputStream *ist, const AVFrame *frame)
+{
+    AVFrame *speech = av_frame_alloc();
+    int ret;
+
+    if (!speech)
+        return AVERROR(ENOMEM);
+
+    speech->format         = frame->format;
+    speech->sample_rate    = frame->sample_rate;
+    speech->channel_layout = frame->channel_layout;
+    speech->channels       = frame->channels;
+    speech->nb_samples     = frame->nb_samples;
+    speech->pts            = frame->pts;
+    ret = av_frame_get_buffer(speech, 0);
+    if (ret < 0)
+        goto fail;
+    av_samples_set_silence(speech->extended_data, 0, speech->nb_samples,
+                           speech->channels, speech->format);
+
+    tts_mix_speech(ist, speech);
+
+    ret = ifilter_send_frame(tts_filter, speech);
+    if (ret == AVERROR_EOF)
+        ret = 0; /* ignore */
+fail:
+    av_frame_free(&speech);
+    return ret;
+}
+
+/**
+ * Feed the [tts] input along the packets of its audio stream when that stream
+ * is copied rather than decoded. The speech is synthesized in s16 with the
+ * stream sample rate and layout, and the gaps between cues are silence.
+ */
+static int tts_copy_speech(InputStream *ist, const AVPacket *pkt)
+{
+    AVCodecContext *par = ist->dec_ctx; /* not opened, only holds the stream parameters */
+    AVRational tb = { 1, par->sample_rate };
+    uint64_t layout = par->channel_layout ? par->channel_layout :
+                      av_get_default_channel_layout(par->channels);
+    int64_t end;
+    int ret = 0;
+
+    if (!pkt) {
+        if (tts_filter->eof)
+            return 0;
+        return ifilter_send_eof(tts_filter, tts_copy_next == AV_NOPTS_VALUE ? AV_NOPTS_VALUE :
+                                av_rescale_q(tts_copy_next, tb, ist->st->time_base));
+    }
+    if (pkt->pts == AV_NOPTS_VALUE || !par->sample_rate || !layout)
+        return 0;
+
+    if (tts_copy_next == AV_NOPTS_VALUE) {
+        AVCodecContext *avctx = avcodec_alloc_context3(NULL);
+
+        if (!avctx)
+            return AVERROR(ENOMEM);
+        ret = avcodec_parameters_to_context(avctx, ist->st->codecpar);
+        if (ret >= 0) {
+            avctx->sample_fmt     = AV_SAMPLE_FMT_S16;
+            avctx->channel_layout = layout;
+            tts_bind_streams(ist, avctx);
+        }
+        avcodec_free_context(&avctx);
+        if (ret < 0)
+            return ret;
+        tts_copy_next = av_rescale_q(pkt->pts, ist->st->time_base, tb);
+    }
+
+    end = av_rescale_q(pkt->pts, ist->st->time_base, tb) +
+          (pkt->duration ? av_rescale_q(pkt->duration, ist->st->time_base, tb) : par->frame_size);
+    while (tts_copy_next < end) {
+        AVFrame *speech = fc_create_silent_frame(par->sample_rate, AV_SAMPLE_FMT_S16, layout);
+
+        if (!speech)
+            return AVERROR(ENOMEM);
+        speech->nb_samples = FFMIN(speech->nb_samples, end - tts_copy_next);
+        speech->pts        = tts_copy_next;
+        tts_copy_next     += speech->nb_samples;
+
+        tts_mix_speech(ist, speech);
+
+        ret = ifilter_send_frame(tts_filter, speech);
+        av_frame_free(&speech);
+        if (ret == AVERROR_EOF)
+            ret = 0; /* ignore */
+        if (ret < 0)
+            break;
+    }
+    return ret;
+}
+
 static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output,
                         int *decode_failed)
 {
@@ -2319,28 +2527,15 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output,
                                               (AVRational){1, avctx->sample_rate});
     ist->nb_samples = decoded_frame->nb_samples;
 
-    /* mix subtitle tts audio */
-    if (!sub_tts_ctx->is_ready)
-    {
-        tts_setup(sub_tts_ctx, avctx);
-        goto skip_mix;
-    }
+    /* subtitle speech is either mixed in here or sent to the [tts] filter input */
+    tts_bind_streams(ist, avctx);
+    if (tts_filter && ist == tts_filter->ist)
+        err = tts_send_speech(ist, decoded_frame);
+    else
+        tts_mix_speech(ist, decoded_frame);
 
-    if (ff_framequeue_queued_frames(&sub_tts_ctx->sub_frame_fifo) > 0)
-    {
-        AVFrame *frame = ff_framequeue_peek(&sub_tts_ctx->sub_frame_fifo, 0);
-        if (frame->pts != AV_NOPTS_VALUE)
-            if(av_compare_ts(decoded_frame->pts, decoded_frame_tb, frame->pts, AV_TIME_BASE_Q) < 0)
-                goto skip_mix;
-        do
-        {
-            sub_tts_ctx->fc_mix(sub_tts_ctx, decoded_frame);
-        } while (ff_framequeue_queued_frames(&sub_tts_ctx->sub_frame_fifo) > 0 && sub_tts_ctx->sample_offset_a > 0);
-    }
-    
-    /* end of mixing */
-skip_mix:
-    err = send_frame_to_filters(ist, decoded_frame);
+    if (err >= 0)
+        err = send_frame_to_filters(ist, decoded_frame);
 
     av_frame_unref(ist->filter_frame);
     av_frame_unref(decoded_frame);
@@ -2480,104 +2675,24 @@ fail:
     return err < 0 ? err : ret;
 }
 
-static int subtitle_tts(AVSubtitle *subtitle)
+static int subtitle_tts(InputStream *ist, AVSubtitle *subtitle)
 {
-    AVFormatContext *fmt_ctx;
-    AVCodecContext *dec_ctx;
-    int stream_index;
-    char *audio_uri;
-    int ret, is_the_first_frame;
-    AVPacket *packet;
-    int64_t pts;
-    uint32_t start;            // time in ms
-    AVRational time_base;
-
-    if (!sub_tts_ctx->is_ready)
-    {
-        av_log(NULL, AV_LOG_WARNING, "%s: Feature convert subtitle to audio isn't ready!\n", __func__);
-        return 0;
-    }
-
-    fmt_ctx = NULL;
-    dec_ctx = NULL;
-    stream_index = -1;
-    audio_uri = av_malloc(160);
-    ret = 0;
-    is_the_first_frame = 1;
-    packet = sub_tts_ctx->decoded_pkt;
-    pts = subtitle->pts;
-    start = subtitle->start_display_time;
+    int i, ret = 0;
 
+    for (i = 0; i < nb_tts_streams; i++) {
+        TTSStream *ts = &tts_streams[i];
 
-    if (ret = subtitle_to_audio(subtitle, sub_tts_ctx, audio_uri) < 0)
-    {
-        av_log(NULL, AV_LOG_ERROR, "%s: Error while call api to convert subtitle to audio fail\n", __func__);
-        goto end;
-    }
-
-    if (ret = open_input(&fmt_ctx, &dec_ctx, &stream_index, audio_uri) < 0)
-    {
-        av_log(NULL, AV_LOG_ERROR, "%s: Error while open received audio fail\n", __func__);
-        goto end;
-    }
-    // calculate offset pts
-    start += pts * 1000 / AV_TIME_BASE;   // in ms unit
-    pts = start * 1000; // in AV_TIME_BASE unit
-    time_base = fmt_ctx->streams[stream_index]->time_base;
+        if (ts->sub_ist && ts->sub_ist != ist)
+            continue;
+        if (!ts->ctx->is_ready) {
+            av_log(NULL, AV_LOG_WARNING, "%s: Feature convert subtitle to audio isn't ready!\n", __func__);
+            continue;
+        }
 
-    while (1)
-    {
-        if (ret = av_read_frame(fmt_ctx, packet) < 0)
+        /* only queued here, the speech is picked up by tts_poll() in decode_audio() */
+        if ((ret = subtitle_to_audio(subtitle, ts->ctx)) < 0)
             break;
-        if (packet->stream_index == stream_index)
-        {
-            ret = avcodec_send_packet(dec_ctx, packet);
-            if (ret < 0)
-            {
-                av_log(NULL, AV_LOG_ERROR, "%s: Error while sending a packet to the decoder\n", __func__);
-                break;
-            }
-
-            while (ret >= 0)
-            {
-                AVFrame *frame = av_frame_alloc();
-                if (!frame)
-                {
-                    ret = AVERROR(ENOMEM);
-                    goto end;
-                }
-                ret = avcodec_receive_frame(dec_ctx, frame);
-                if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-                {
-                    break;
-                }
-                else if (ret < 0)
-                {
-                    av_log(NULL, AV_LOG_ERROR, "%s: Error while receiving a frame from the decoder\n", __func__);
-                    goto end;
-                }
-
-                if (ret >= 0)
-                {
-                    if (is_the_first_frame)
-                    {
-                        frame->pts = pts + av_rescale_q(frame->pts, time_base, AV_TIME_BASE_Q);
-                        is_the_first_frame = 0;
-                    }
-                    else
-                        frame->pts = AV_NOPTS_VALUE;
-                    ff_framequeue_add(&sub_tts_ctx->sub_frame_fifo, frame);
-                }
-            }
-        }
-        av_packet_unref(packet);
     }
-
-end:
-    avcodec_free_context(&dec_ctx);
-    avformat_close_input(&fmt_ctx);
-    if (audio_uri)
-        av_freep(&audio_uri);
     return ret;
 }
 
@@ -2600,7 +2715,7 @@ static int transcode_subtitles(InputStream *ist, AVPacket *pkt, int *got_output,
 
     /* convert text to audio of subtitle here */
 
-    if (subtitle_tts(&subtitle) < 0)
+    if (subtitle_tts(ist, &subtitle) < 0)
         av_log(NULL, AV_LOG_WARNING, "converting subtitle to audio failed error\n");
 
     /* end of converting */
@@ -2677,6 +2792,8 @@ static int send_filter_eof(InputStream *ist)
         if (ret < 0)
             return ret;
     }
+    if (tts_filter && tts_filter->ist == ist)
+        return ifilter_send_eof(tts_filter, pts);
     return 0;
 }
 
@@ -2860,6 +2977,13 @@ static int process_input_packet(InputStream *ist, const AVPacket *pkt, int no_eo
         do_streamcopy(ist, ost, pkt);
     }
 
+    if (tts_filter && ist == tts_filter->ist && !ist->decoding_needed &&
+        (pkt || !no_eof) && tts_copy_speech(ist, pkt) < 0) {
+        av_log(NULL, AV_LOG_FATAL, "Error while sending the subtitle speech along "
+               "stream #%d:%d\n", ist->file_index, ist->st->index);
+        exit_program(1);
+    }
+
     return !eof_reached;
 }
 
@@ -4413,6 +4537,10 @@ static int process_input(int file_index)
                 ret = process_input_packet(ist, NULL, 0);
                 if (ret>0)
                     return 0;
+            } else if (tts_filter && ist == tts_filter->ist) {
+                ret = tts_copy_speech(ist, NULL);
+                if (ret < 0)
+                    return ret;
             }
 
             /* mark all outputs that don't go through lavfi as finished */
@@ -4633,6 +4761,168 @@ discard_packet:
     return 0;
 }
 
+/**
+ * Read the subtitle files ahead of the audio, so that the speech of a cue is
+ * requested tts_prefetch seconds before it has to be mixed.
+ */
+static int tts_prefetch_subtitles(void)
+{
+    int64_t limit = INT64_MAX;
+    int i, ret;
+
+    if (tts_prefetch <= 0)
+        return 0;
+    /* the subtitle files are shared, so the audio furthest behind sets the pace,
+     * and nothing is read before every audio stream is ready for its speech */
+    for (i = 0; i < nb_tts_streams; i++) {
+        if (!tts_streams[i].ctx->is_ready || tts_streams[i].audio_ts == AV_NOPTS_VALUE)
+            return 0;
+        limit = FFMIN(limit, tts_streams[i].audio_ts);
+    }
+    limit += (int64_t)(tts_prefetch * AV_TIME_BASE);
+
+    for (i = 0; i < nb_input_files; i++) {
+        InputFile *ifile = input_files[i];
+
+        if (!ifile->tts_prefetch)
+            continue;
+        while (!ifile->eof_reached && !ifile->eagain && ifile->last_ts < limit) {
+            ret = process_input(i);
+            if (ret == AVERROR(EAGAIN))
+                break;
+            if (ret < 0)
+                return ret == AVERROR_EOF ? 0 : ret;
+        }
+    }
+
+    return 0;
+}
+
+/* only files made of text subtitles are read ahead, they hold every cue up front */
+static void tts_prefetch_init(void)
+{
+    int i, j;
+
+    if (tts_prefetch <= 0)
+        return;
+
+    for (i = 0; i < nb_input_files; i++) {
+        InputFile *ifile = input_files[i];
+        int text_subs = 0;
+
+        for (j = 0; j < ifile->nb_streams; j++) {
+            InputStream *ist = input_streams[ifile->ist_index + j];
+            const AVCodecDescriptor *desc = avcodec_descriptor_get(ist->st->codecpar->codec_id);
+
+            if (ist->st->codecpar->codec_type != AVMEDIA_TYPE_SUBTITLE ||
+                !desc || !(desc->props & AV_CODEC_PROP_TEXT_SUB)) {
+                text_subs = 0;
+                break;
+            }
+            text_subs |= ist->decoding_needed;
+        }
+        ifile->tts_prefetch = text_subs;
+    }
+}
+
+/* find the input stream of the given type matching spec, file_index:stream_specifier */
+static InputStream *tts_find_stream(const char *spec, enum AVMediaType type)
+{
+    AVFormatContext *s;
+    char *p;
+    int file_idx = strtol(spec, &p, 0);
+    int i;
+
+    if (file_idx < 0 || file_idx >= nb_input_files || (*p && *p != ':')) {
+        av_log(NULL, AV_LOG_ERROR, "Invalid input file index in tts mapping '%s'\n", spec);
+        return NULL;
+    }
+    s = input_files[file_idx]->ctx;
+
+    for (i = 0; i < s->nb_streams; i++) {
+        InputStream *ist = input_streams[input_files[file_idx]->ist_index + i];
+
+        if (s->streams[i]->codecpar->codec_type != type ||
+            check_stream_specifier(s, s->streams[i], *p == ':' ? p + 1 : p) != 1)
+            continue;
+        /* a copied audio stream still carries speech when it feeds [tts],
+         * the speech then goes along its packets in tts_copy_speech() */
+        if (!ist->decoding_needed &&
+            !(type == AVMEDIA_TYPE_AUDIO && tts_filter && ist == tts_filter->ist)) {
+            av_log(NULL, AV_LOG_ERROR, "Stream #%d:%d of tts mapping '%s' is not decoded, "
+                   "it has to be transcoded to an output or feed [tts]\n", file_idx, i, spec);
+            return NULL;
+        }
+        return ist;
+    }
+
+    av_log(NULL, AV_LOG_ERROR, "No %s stream matches '%s' in tts mapping\n",
+           av_get_media_type_string(type), spec);
+    return NULL;
+}
+
+/* without -tts_map, every subtitle stream is spoken into the first decoded audio stream */
+static int tts_init_streams(void)
+{
+    int i, ret;
+
+    tts_streams = av_mallocz_array(FFMAX(nb_tts_maps, 1), sizeof(*tts_streams));
+    if (!tts_streams)
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < FFMAX(nb_tts_maps, 1); i++) {
+        TTSStream *ts = &tts_streams[i];
+        SubTTSContext *ctx;
+
+        ts->audio_ts = AV_NOPTS_VALUE;
+        if (nb_tts_maps) {
+            char *sub_spec = av_strdup(tts_maps[i]);
+            char *audio_spec;
+
+            if (!sub_spec)
+                return AVERROR(ENOMEM);
+            audio_spec = strchr(sub_spec, '=');
+            *audio_spec++ = 0;
+            ts->sub_ist   = tts_find_stream(sub_spec, AVMEDIA_TYPE_SUBTITLE);
+            ts->audio_ist = tts_find_stream(audio_spec, AVMEDIA_TYPE_AUDIO);
+            av_free(sub_spec);
+            if (!ts->sub_ist || !ts->audio_ist)
+                return AVERROR(EINVAL);
+        }
+
+        ctx = ts->ctx = av_mallocz(sizeof(*ctx));
+        if (!ctx)
+            return AVERROR(ENOMEM);
+        nb_tts_streams++;
+        ctx->nb_workers = tts_threads;
+        ctx->batch_size = tts_batch;
+        ctx->batch_window = tts_batch_window * AV_TIME_BASE;
+        ctx->queue_size = TTS_DEFAULT_QUEUE_SIZE;
+        ctx->raw_audio = tts_raw_audio;
+        ctx->audio_format = tts_audio_format;
+        ctx->voice = tts_voice;
+        ctx->cache.max_entries = tts_cache_size;
+        ctx->cache.dir = tts_cache_dir;
+        ctx->sync = tts_prefetch > 0;
+        ctx->fit_tempo = tts_fit;
+        ctx->duck_gain = pow(10, -fabs(tts_duck) / 20);
+        ctx->duck_attack = tts_duck_attack;
+        ctx->duck_release = tts_duck_release;
+        ctx->backend_name = tts_backend;
+        ctx->endpoints = tts_endpoints;
+        ctx->balance = tts_balance;
+        ctx->api_gen = tts_api_gen;
+        ctx->api_get = tts_api_get;
+        ctx->stats_pb = tts_stats_avio;
+        ctx->stats_index = i;
+        if ((ret = tts_init(ctx)) < 0)
+            return ret;
+    }
+    tts_prefetch_init();
+
+    return 0;
+}
+
 /**
  * Perform a step of transcoding for the specified filter graph.
  *
@@ -4755,6 +5045,9 @@ static int transcode_step(void)
     if (ret < 0)
         return ret == AVERROR_EOF ? 0 : ret;
 
+    if ((ret = tts_prefetch_subtitles()) < 0)
+        return ret;
+
     return reap_filters(0);
 }
 
@@ -4775,14 +5068,7 @@ static int transcode(void)
         goto fail;
     
     /* initialization of subtitle tts */
-    sub_tts_ctx = av_malloc(sizeof(*sub_tts_ctx));
-    if (!sub_tts_ctx)
-    {
-        ret = AVERROR(ENOMEM);
-        goto fail;
-    }
-    ret = tts_init(sub_tts_ctx);
-    if (ret < 0)
+    if ((ret = tts_init_streams()) < 0)
         goto fail;
     /* end of subtitle tts initialization */
     
@@ -4915,8 +5201,13 @@ static int transcode(void)
         }
     }
     /* deinit subtitle tts */
-    tts_cleanup(sub_tts_ctx);
-    av_freep(&sub_tts_ctx);
+    for (i = 0; i < nb_tts_streams; i++) {
+        tts_cleanup(tts_streams[i].ctx);
+        av_freep(&tts_streams[i].ctx);
+    }
+    av_freep(&tts_streams);
+    nb_tts_streams = 0;
+    avio_closep(&tts_stats_avio);
     /* end of deinit */
     return ret;
 }
@@ -252,6 +252,8 @@ typedef struct InputFilter {
 
     AVBufferRef *hw_frames_ctx;
 
+    int sub2video_bbox;     // sub2video frames go straight into the overlay input of overlay
+
     int eof;
 } InputFilter;
 
@@ -348,6 +350,7 @@ typedef struct InputStream {
         AVFifoBuffer *sub_queue;    ///< queue of AVSubtitle* before filter init
         AVFrame *frame;
         int w, h;
+        int x0, y0, x1, y1;      ///< bounding box of the rectangles drawn on frame, empty if x1 <= x0
         unsigned int initialize; ///< marks if sub2video_update should force an initialization
     } sub2video;
 
@@ -419,6 +422,7 @@ typedef struct InputFile {
     int joined;                 /* the thread has been joined */
     int thread_queue_size;      /* maximum number of queued packets */
 #endif
+    int tts_prefetch;           /* subtitles are read ahead of the audio for the tts */
 } InputFile;
 
 enum forced_keyframes_const {
@@ -610,6 +614,28 @@ extern char *videotoolbox_pixfmt;
 extern int filter_nbthreads;
 extern int filter_complex_nbthreads;
 extern int vstats_version;
+extern int tts_raw_audio;
+extern char *tts_audio_format;
+extern char *tts_voice;
+extern int tts_cache_size;
+extern char *tts_cache_dir;
+extern float tts_prefetch;
+extern float tts_duck;
+extern float tts_duck_attack;
+extern float tts_duck_release;
+extern char *tts_endpoints;
+extern char *tts_balance;
+extern char *tts_api_gen;
+extern char *tts_api_get;
+extern int tts_threads;
+extern int tts_batch;
+extern float tts_batch_window;
+extern char *tts_backend;
+extern float tts_fit;
+extern char **tts_maps;
+extern int nb_tts_maps;
+extern InputFilter *tts_filter;
+extern AVIOContext *tts_stats_avio;
 
 extern const AVIOInterruptCB int_cb;
 
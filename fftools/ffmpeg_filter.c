@@ -264,7 +264,27 @@ static void init_input_filter(FilterGraph *fg, AVFilterInOut *in)
         exit_program(1);
     }
 
-    if (in->name) {
+    if (in->name && !strcmp(in->name, "tts")) {
+        /* subtitle speech, produced alongside the first audio stream and
+         * following its timestamps; that stream is not decoded for it, so it
+         * can still be stream copied */
+        if (type != AVMEDIA_TYPE_AUDIO || tts_filter) {
+            av_log(NULL, AV_LOG_FATAL, "The [tts] input must be used once, on an audio "
+                   "pad, in filtergraph description %s.\n", fg->graph_desc);
+            exit_program(1);
+        }
+        for (i = 0; i < nb_input_streams; i++) {
+            ist = input_streams[i];
+            if (ist->user_set_discard != AVDISCARD_ALL &&
+                ist->st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+                break;
+        }
+        if (i == nb_input_streams) {
+            av_log(NULL, AV_LOG_FATAL, "The [tts] input in filtergraph description %s "
+                   "needs an audio input stream.\n", fg->graph_desc);
+            exit_program(1);
+        }
+    } else if (in->name) {
         AVFormatContext *s;
         AVStream       *st = NULL;
         char *p;
@@ -318,7 +338,8 @@ static void init_input_filter(FilterGraph *fg, AVFilterInOut *in)
     av_assert0(ist);
 
     ist->discard         = 0;
-    ist->decoding_needed |= DECODING_FOR_FILTER;
+    if (!in->name || strcmp(in->name, "tts"))
+        ist->decoding_needed |= DECODING_FOR_FILTER;
     ist->st->discard = AVDISCARD_NONE;
 
     GROW_ARRAY(fg->inputs, fg->nb_inputs);
@@ -334,6 +355,12 @@ static void init_input_filter(FilterGraph *fg, AVFilterInOut *in)
     if (!fg->inputs[fg->nb_inputs - 1]->frame_queue)
         exit_program(1);
 
+    /* the [tts] input is fed from decode_audio(), not with the decoded frames */
+    if (in->name && !strcmp(in->name, "tts")) {
+        tts_filter = fg->inputs[fg->nb_inputs - 1];
+        return;
+    }
+
     GROW_ARRAY(ist->filters, ist->nb_filters);
     ist->filters[ist->nb_filters - 1] = fg->inputs[fg->nb_inputs - 1];
 }
@@ -850,6 +877,12 @@ static int configure_input_video_filter(FilterGraph *fg, InputFilter *ifilter,
         last_filter = yadif;
     }
 
+    /* overlay may then trust the box of the drawn region of the canvas,
+       trim being the only filter that can still come in between */
+    ifilter->sub2video_bbox = ist->dec_ctx->codec_type == AVMEDIA_TYPE_SUBTITLE &&
+                              last_filter == ifilter->filter && in->pad_idx == 1 &&
+                              !strcmp(in->filter_ctx->filter->name, "overlay");
+
     snprintf(name, sizeof(name), "trim_in_%d_%d",
              ist->file_index, ist->st->index);
     if (copy_ts) {
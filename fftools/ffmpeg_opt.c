@@ -23,6 +23,7 @@
 
 #include "ffmpeg.h"
 #include "cmdutils.h"
+#include "features.h"
 
 #include "libavformat/avformat.h"
 
@@ -171,6 +172,26 @@ float max_error_rate  = 2.0/3;
 int filter_nbthreads = 0;
 int filter_complex_nbthreads = 0;
 int vstats_version = 2;
+int tts_raw_audio = 0;
+char *tts_audio_format = NULL;
+char *tts_voice = NULL;
+int tts_cache_size = TTS_DEFAULT_CACHE_SIZE;
+char *tts_cache_dir = NULL;
+float tts_prefetch = 0;
+float tts_duck = 0;
+float tts_duck_attack = 0.05;
+float tts_duck_release = 0.3;
+char *tts_endpoints = NULL;
+char *tts_balance = NULL;
+char *tts_api_gen = NULL;
+char *tts_api_get = NULL;
+int tts_threads = TTS_DEFAULT_WORKERS;
+int tts_batch = 1;
+float tts_batch_window = 2.0;
+char *tts_backend = NULL;
+float tts_fit = 0;
+char **tts_maps = NULL;
+int nb_tts_maps = 0;
 
 
 static int intra_only         = 0;
@@ -3169,6 +3190,20 @@ static int opt_filter_complex(void *optctx, const char *opt, const char *arg)
     return 0;
 }
 
+static int opt_tts_map(void *optctx, const char *opt, const char *arg)
+{
+    if (!strchr(arg, '=')) {
+        av_log(NULL, AV_LOG_ERROR, "Invalid tts mapping '%s', expected "
+               "subtitle_stream=audio_stream, e.g. 1:s:0=0:a:1\n", arg);
+        return AVERROR(EINVAL);
+    }
+    GROW_ARRAY(tts_maps, nb_tts_maps);
+    if (!(tts_maps[nb_tts_maps - 1] = av_strdup(arg)))
+        return AVERROR(ENOMEM);
+
+    return 0;
+}
+
 static int opt_filter_complex_script(void *optctx, const char *opt, const char *arg)
 {
     uint8_t *graph_desc = read_file(arg);
@@ -3384,6 +3419,22 @@ static int opt_progress(void *optctx, const char *opt, const char *arg)
     return 0;
 }
 
+static int opt_tts_stats(void *optctx, const char *opt, const char *arg)
+{
+    int ret;
+
+    if (!strcmp(arg, "-"))
+        arg = "pipe:";
+    avio_closep(&tts_stats_avio);
+    ret = avio_open2(&tts_stats_avio, arg, AVIO_FLAG_WRITE, &int_cb, NULL);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Failed to open subtitle tts stats URL \"%s\": %s\n",
+               arg, av_err2str(ret));
+        return ret;
+    }
+    return 0;
+}
+
 #define OFFSET(x) offsetof(OptionsContext, x)
 const OptionDef options[] = {
     /* main options */
@@ -3543,6 +3594,47 @@ const OptionDef options[] = {
         "read complex filtergraph description from a file", "filename" },
     { "stats",          OPT_BOOL,                                    { &print_stats },
         "print progress report during encoding", },
+    { "tts_raw",        OPT_BOOL | OPT_EXPERT,                       { &tts_raw_audio },
+        "ask the subtitle tts server for raw samples in a single request" },
+    { "tts_format",     HAS_ARG | OPT_STRING | OPT_EXPERT,           { &tts_audio_format },
+        "force the format of the subtitle tts audio instead of probing it", "fmt" },
+    { "tts_voice",      HAS_ARG | OPT_STRING | OPT_EXPERT,           { &tts_voice },
+        "set the voice of the subtitle tts", "voice" },
+    { "tts_cache_size", HAS_ARG | OPT_INT | OPT_EXPERT,              { &tts_cache_size },
+        "number of synthesized subtitles kept in memory (0 to disable)", "n" },
+    { "tts_cache_dir",  HAS_ARG | OPT_STRING | OPT_EXPERT,           { &tts_cache_dir },
+        "spill synthesized subtitles evicted from memory to this directory", "dir" },
+    { "tts_prefetch",   HAS_ARG | OPT_FLOAT | OPT_EXPERT,            { &tts_prefetch },
+        "read subtitle files this many seconds ahead of the audio and keep the speech in sync", "seconds" },
+    { "tts_fit",        HAS_ARG | OPT_FLOAT | OPT_EXPERT,            { &tts_fit },
+        "speed subtitle speech up by at most this factor to fit in the subtitle duration, 0 to disable", "factor" },
+    { "tts_duck",       HAS_ARG | OPT_FLOAT | OPT_EXPERT,            { &tts_duck },
+        "attenuate the program audio by this many dB under subtitle speech", "dB" },
+    { "tts_duck_attack", HAS_ARG | OPT_FLOAT | OPT_EXPERT,           { &tts_duck_attack },
+        "time for the ducking to reach its full attenuation", "seconds" },
+    { "tts_duck_release", HAS_ARG | OPT_FLOAT | OPT_EXPERT,          { &tts_duck_release },
+        "time for the program audio to recover after subtitle speech", "seconds" },
+    { "tts_backend",    HAS_ARG | OPT_STRING | OPT_EXPERT,           { &tts_backend },
+        "synthesize the subtitles with a tts server (http) or in process (flite)", "backend" },
+    { "tts_endpoints",  HAS_ARG | OPT_STRING | OPT_EXPERT,           { &tts_endpoints },
+        "comma separated list of tts servers, host:port or unix:path", "list" },
+    { "tts_balance",    HAS_ARG | OPT_STRING | OPT_EXPERT,           { &tts_balance },
+        "spread the tts requests round robin (rr) or to the least loaded endpoint (lo)", "mode" },
+    { "tts_api_gen",    HAS_ARG | OPT_STRING | OPT_EXPERT,           { &tts_api_gen },
+        "path of the tts synthesis request", "path" },
+    { "tts_api_get",    HAS_ARG | OPT_STRING | OPT_EXPERT,           { &tts_api_get },
+        "path prefix of the synthesized audio, followed by its id", "path" },
+    { "tts_threads",    HAS_ARG | OPT_INT | OPT_EXPERT,              { &tts_threads },
+        "number of concurrent tts requests, 0 to synthesize in the transcode loop", "count" },
+    { "tts_batch",      HAS_ARG | OPT_INT | OPT_EXPERT,              { &tts_batch },
+        "maximum number of queued subtitles synthesized in a single tts request", "count" },
+    { "tts_batch_window", HAS_ARG | OPT_FLOAT | OPT_EXPERT,          { &tts_batch_window },
+        "only batch subtitles starting within this many seconds of the first one", "seconds" },
+    { "tts_map",        HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_tts_map },
+        "speak the subtitles of an input stream into an input audio stream, "
+        "can be repeated for several programs", "subtitle_stream=audio_stream" },
+    { "tts_stats",      HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_tts_stats },
+        "write the stage timings of each subtitle speech as JSON lines to this URL", "url" },
     { "attach",         HAS_ARG | OPT_PERFILE | OPT_EXPERT |
                         OPT_OUTPUT,                                  { .func_arg = opt_attach },
         "add an attachment to the output file", "filename" },
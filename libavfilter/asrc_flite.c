@@ -27,8 +27,10 @@
 #include "libavutil/channel_layout.h"
 #include "libavutil/file.h"
 #include "libavutil/opt.h"
+#include "libavutil/thread.h"
 #include "avfilter.h"
 #include "audio.h"
+#include "filters.h"
 #include "formats.h"
 #include "internal.h"
 
@@ -63,7 +65,9 @@ static const AVOption flite_options[] = {
 
 AVFILTER_DEFINE_CLASS(flite);
 
-static volatile int flite_inited = 0;
+/* protects flite_inited and the voice entries, instances may be created from several threads */
+static AVMutex flite_mutex = AV_MUTEX_INITIALIZER;
+static int flite_inited = 0;
 
 /* declare functions for all the supported voices */
 #define DECLARE_REGISTER_VOICE_FN(name) \
@@ -111,14 +115,20 @@ static int select_voice(struct voice_entry **entry_ret, const char *voice_name,
     for (i = 0; i < FF_ARRAY_ELEMS(voice_entries); i++) {
         struct voice_entry *entry = &voice_entries[i];
         if (!strcmp(entry->name, voice_name)) {
+            cst_voice *voice;
+
+            ff_mutex_lock(&flite_mutex);
             if (!entry->voice)
                 entry->voice = entry->register_fn(NULL);
-            if (!entry->voice) {
+            voice = entry->voice;
+            if (voice)
+                entry->usage_count++;
+            ff_mutex_unlock(&flite_mutex);
+            if (!voice) {
                 av_log(log_ctx, AV_LOG_ERROR,
                        "Could not register voice '%s'\n", voice_name);
                 return AVERROR_UNKNOWN;
             }
-            entry->usage_count++;
             *entry_ret = entry;
             return 0;
         }
@@ -141,12 +151,14 @@ static av_cold int init(AVFilterContext *ctx)
         return AVERROR_EXIT;
     }
 
-    if (!flite_inited) {
-        if (flite_init() < 0) {
-            av_log(ctx, AV_LOG_ERROR, "flite initialization failed\n");
-            return AVERROR_UNKNOWN;
-        }
-        flite_inited++;
+    ff_mutex_lock(&flite_mutex);
+    if (!flite_inited && flite_init() >= 0)
+        flite_inited = 1;
+    ret = flite_inited ? 0 : AVERROR_UNKNOWN;
+    ff_mutex_unlock(&flite_mutex);
+    if (ret < 0) {
+        av_log(ctx, AV_LOG_ERROR, "flite initialization failed\n");
+        return ret;
     }
 
     if ((ret = select_voice(&flite->voice_entry, flite->voice_str, ctx)) < 0)
@@ -196,8 +208,14 @@ static av_cold void uninit(AVFilterContext *ctx)
 {
     FliteContext *flite = ctx->priv;
 
-    if (!--flite->voice_entry->usage_count)
-        flite->voice_entry->unregister_fn(flite->voice);
+    if (flite->voice_entry) {
+        ff_mutex_lock(&flite_mutex);
+        if (!--flite->voice_entry->usage_count) {
+            flite->voice_entry->unregister_fn(flite->voice);
+            flite->voice_entry->voice = NULL;
+        }
+        ff_mutex_unlock(&flite_mutex);
+    }
     flite->voice = NULL;
     flite->voice_entry = NULL;
     delete_wave(flite->wave);
@@ -245,8 +263,10 @@ static int request_frame(AVFilterLink *outlink)
     FliteContext *flite = outlink->src->priv;
     int nb_samples = FFMIN(flite->wave_nb_samples, flite->frame_nb_samples);
 
-    if (!nb_samples)
-        return AVERROR_EOF;
+    if (!nb_samples) {
+        ff_outlink_set_status(outlink, AVERROR_EOF, flite->pts);
+        return 0;
+    }
 
     samplesref = ff_get_audio_buffer(outlink, nb_samples);
     if (!samplesref)
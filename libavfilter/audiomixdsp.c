@@ -0,0 +1,163 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+#include "libavutil/attributes.h"
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+
+#include "audiomixdsp.h"
+
+static void mix_u8_c(uint8_t *dst, const uint8_t *src, ptrdiff_t len)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = av_clip_uint8(dst[i] + src[i] - 0x80);
+}
+
+static void mix_s16_c(uint8_t *_dst, const uint8_t *_src, ptrdiff_t len)
+{
+    int16_t *dst = (int16_t *)_dst;
+    const int16_t *src = (const int16_t *)_src;
+    int i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = av_clip_int16(dst[i] + src[i]);
+}
+
+static void mix_s32_c(uint8_t *_dst, const uint8_t *_src, ptrdiff_t len)
+{
+    int32_t *dst = (int32_t *)_dst;
+    const int32_t *src = (const int32_t *)_src;
+    int i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = av_clipl_int32((int64_t)dst[i] + src[i]);
+}
+
+static void mix_flt_c(uint8_t *_dst, const uint8_t *_src, ptrdiff_t len)
+{
+    float *dst = (float *)_dst;
+    const float *src = (const float *)_src;
+    int i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = av_clipf(dst[i] + src[i], -1.0f, 1.0f);
+}
+
+static void mix_dbl_c(uint8_t *_dst, const uint8_t *_src, ptrdiff_t len)
+{
+    double *dst = (double *)_dst;
+    const double *src = (const double *)_src;
+    int i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = av_clipd(dst[i] + src[i], -1.0, 1.0);
+}
+
+static void mix_scaled_u8_c(uint8_t *dst, const uint8_t *src, float gain, ptrdiff_t len)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = av_clip_uint8(lrintf((dst[i] - 0x80) * gain) + src[i]);
+}
+
+static void mix_scaled_s16_c(uint8_t *_dst, const uint8_t *_src, float gain, ptrdiff_t len)
+{
+    int16_t *dst = (int16_t *)_dst;
+    const int16_t *src = (const int16_t *)_src;
+    int i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = av_clip_int16(lrintf(dst[i] * gain) + src[i]);
+}
+
+static void mix_scaled_s32_c(uint8_t *_dst, const uint8_t *_src, float gain, ptrdiff_t len)
+{
+    int32_t *dst = (int32_t *)_dst;
+    const int32_t *src = (const int32_t *)_src;
+    int i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = av_clipl_int32(llrint(dst[i] * (double)gain) + src[i]);
+}
+
+static void mix_scaled_flt_c(uint8_t *_dst, const uint8_t *_src, float gain, ptrdiff_t len)
+{
+    float *dst = (float *)_dst;
+    const float *src = (const float *)_src;
+    int i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = av_clipf(dst[i] * gain + src[i], -1.0f, 1.0f);
+}
+
+static void mix_scaled_dbl_c(uint8_t *_dst, const uint8_t *_src, float gain, ptrdiff_t len)
+{
+    double *dst = (double *)_dst;
+    const double *src = (const double *)_src;
+    int i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = av_clipd(dst[i] * gain + src[i], -1.0, 1.0);
+}
+
+av_cold int ff_audiomixdsp_init(AVAudioMixDSPContext *c, enum AVSampleFormat sample_fmt)
+{
+    switch (av_get_packed_sample_fmt(sample_fmt)) {
+    case AV_SAMPLE_FMT_U8:
+        c->mix        = mix_u8_c;
+        c->mix_scaled = mix_scaled_u8_c;
+        break;
+    case AV_SAMPLE_FMT_S16:
+        c->mix        = mix_s16_c;
+        c->mix_scaled = mix_scaled_s16_c;
+        break;
+    case AV_SAMPLE_FMT_S32:
+        c->mix        = mix_s32_c;
+        c->mix_scaled = mix_scaled_s32_c;
+        break;
+    case AV_SAMPLE_FMT_FLT:
+        c->mix        = mix_flt_c;
+        c->mix_scaled = mix_scaled_flt_c;
+        break;
+    case AV_SAMPLE_FMT_DBL:
+        c->mix        = mix_dbl_c;
+        c->mix_scaled = mix_scaled_dbl_c;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+
+    if (ARCH_X86)
+        ff_audiomixdsp_init_x86(c, sample_fmt);
+
+    return 0;
+}
+
+AVAudioMixDSPContext *av_audiomix_dsp_alloc(enum AVSampleFormat sample_fmt)
+{
+    AVAudioMixDSPContext *c = av_mallocz(sizeof(*c));
+
+    if (c && ff_audiomixdsp_init(c, sample_fmt) < 0)
+        av_freep(&c);
+    return c;
+}
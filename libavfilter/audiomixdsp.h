@@ -0,0 +1,75 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Saturating addition of one audio buffer into another, optionally scaling
+ * the destination first
+ */
+
+#ifndef AVFILTER_AUDIOMIXDSP_H
+#define AVFILTER_AUDIOMIXDSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libavutil/samplefmt.h"
+
+/**
+ * Saturating mix functions of one sample format. New fields may be added at
+ * the end with minor version bumps, use av_audiomix_dsp_alloc() to get one.
+ */
+typedef struct AVAudioMixDSPContext {
+    /**
+     * Add len samples of src to dst, clipping the sums to the range of the
+     * sample format: [INT16_MIN, INT16_MAX] for s16, [-1.0, 1.0] for float,
+     * and so on. u8 samples are treated as centered on 128.
+     * dst and src need no particular alignment.
+     *
+     * @param len number of samples, a multiple of 32
+     */
+    void (*mix)(uint8_t *dst, const uint8_t *src, ptrdiff_t len);
+
+    /**
+     * Same as mix, with dst multiplied by gain before src is added.
+     *
+     * @param len number of samples, a multiple of 32
+     */
+    void (*mix_scaled)(uint8_t *dst, const uint8_t *src, float gain, ptrdiff_t len);
+} AVAudioMixDSPContext;
+
+/**
+ * Allocate a mix context for sample_fmt and set it up as
+ * ff_audiomixdsp_init() does. It must be freed with av_free().
+ *
+ * @return the context, NULL if sample_fmt is not supported or on
+ *         allocation failure
+ */
+AVAudioMixDSPContext *av_audiomix_dsp_alloc(enum AVSampleFormat sample_fmt);
+
+/**
+ * Set up the mix function for sample_fmt. Planar and packed variants of
+ * a format share the same function, it works on a single plane.
+ *
+ * @return 0 on success, AVERROR(EINVAL) if sample_fmt is not supported
+ */
+int ff_audiomixdsp_init(AVAudioMixDSPContext *c, enum AVSampleFormat sample_fmt);
+
+void ff_audiomixdsp_init_x86(AVAudioMixDSPContext *c, enum AVSampleFormat sample_fmt);
+
+#endif /* AVFILTER_AUDIOMIXDSP_H */
@@ -0,0 +1,135 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+#include "libavfilter/audiomixdsp.h"
+
+/* every pair of these is mixed, the full scale ones saturate */
+static const double levels[] = { -1.0, -0.75, -0.5, -0.1, 0.0, 0.1, 0.5, 0.75, 1.0 };
+
+#define NB_LEVELS FF_ARRAY_ELEMS(levels)
+/* a multiple of 32 holding every pair */
+#define LEN 96
+
+/* the sample at i as a value of the format, 128 centered for u8 */
+static double get_sample(const uint8_t *buf, enum AVSampleFormat fmt, int i)
+{
+    switch (fmt) {
+    case AV_SAMPLE_FMT_U8:  return buf[i] - 0x80;
+    case AV_SAMPLE_FMT_S16: return ((const int16_t *)buf)[i];
+    case AV_SAMPLE_FMT_S32: return ((const int32_t *)buf)[i];
+    case AV_SAMPLE_FMT_FLT: return ((const float   *)buf)[i];
+    default:                return ((const double  *)buf)[i];
+    }
+}
+
+static void set_sample(uint8_t *buf, enum AVSampleFormat fmt, int i, double level)
+{
+    switch (fmt) {
+    case AV_SAMPLE_FMT_U8:  buf[i] = av_clip_uint8(lrint(level * 127) + 0x80);          break;
+    case AV_SAMPLE_FMT_S16: ((int16_t *)buf)[i] = lrint(level * INT16_MAX);             break;
+    case AV_SAMPLE_FMT_S32: ((int32_t *)buf)[i] = llrint(level * INT32_MAX);            break;
+    case AV_SAMPLE_FMT_FLT: ((float   *)buf)[i] = level;                                break;
+    default:                ((double  *)buf)[i] = level;                                break;
+    }
+}
+
+static int test_mix(enum AVSampleFormat fmt, float gain)
+{
+    const enum AVSampleFormat packed = av_get_packed_sample_fmt(fmt);
+    const int is_float = packed == AV_SAMPLE_FMT_FLT || packed == AV_SAMPLE_FMT_DBL;
+    /* the integer formats may round the scaled sample either way */
+    const double max_error = is_float ? 1e-6 : gain == 1.0f ? 0 : 1;
+    double expected[LEN], lo, hi;
+    AVAudioMixDSPContext *c = av_audiomix_dsp_alloc(fmt);
+    uint8_t *dst = av_malloc(LEN * sizeof(double));
+    uint8_t *src = av_malloc(LEN * sizeof(double));
+    int i, errors = 0, ret = 0;
+
+    if (!c || !dst || !src) {
+        ret = -1;
+        goto end;
+    }
+
+    switch (packed) {
+    case AV_SAMPLE_FMT_U8:  lo = -0x80;     hi = 0x7F;      break;
+    case AV_SAMPLE_FMT_S16: lo = INT16_MIN; hi = INT16_MAX; break;
+    case AV_SAMPLE_FMT_S32: lo = INT32_MIN; hi = INT32_MAX; break;
+    default:                lo = -1.0;      hi = 1.0;       break;
+    }
+
+    for (i = 0; i < LEN; i++) {
+        set_sample(dst, packed, i, i < NB_LEVELS * NB_LEVELS ? levels[i / NB_LEVELS] : 0.0);
+        set_sample(src, packed, i, i < NB_LEVELS * NB_LEVELS ? levels[i % NB_LEVELS] : 0.0);
+    }
+
+    for (i = 0; i < LEN; i++) {
+        double d = get_sample(dst, packed, i), s = get_sample(src, packed, i);
+        expected[i] = av_clipd((is_float ? d * gain : rint(d * gain)) + s, lo, hi);
+    }
+
+    if (gain == 1.0f)
+        c->mix(dst, src, LEN);
+    else
+        c->mix_scaled(dst, src, gain, LEN);
+
+    for (i = 0; i < LEN; i++) {
+        double got = get_sample(dst, packed, i);
+
+        if (fabs(got - expected[i]) > max_error && errors++ < 5)
+            printf("%s sample %d: %g, expected %g\n",
+                   av_get_sample_fmt_name(fmt), i, got, expected[i]);
+    }
+    printf("%-4s %-10s gain %.2f: %s\n", av_get_sample_fmt_name(fmt),
+           gain == 1.0f ? "mix" : "mix_scaled", gain, errors ? "FAILED" : "ok");
+    ret = errors > 0;
+
+end:
+    av_free(c);
+    av_free(dst);
+    av_free(src);
+    return ret;
+}
+
+int main(void)
+{
+    static const enum AVSampleFormat fmts[] = {
+        AV_SAMPLE_FMT_U8,  AV_SAMPLE_FMT_S16,  AV_SAMPLE_FMT_S32,
+        AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_DBL,  AV_SAMPLE_FMT_S16P,
+        AV_SAMPLE_FMT_FLTP,
+    };
+    static const float gains[] = { 1.0f, 0.5f, 0.3f };
+    AVAudioMixDSPContext *c;
+    int i, j, ret = 0;
+
+    for (i = 0; i < FF_ARRAY_ELEMS(fmts); i++)
+        for (j = 0; j < FF_ARRAY_ELEMS(gains); j++)
+            ret |= test_mix(fmts[i], gains[j]) != 0;
+
+    /* the formats without a mix function are refused */
+    c = av_audiomix_dsp_alloc(AV_SAMPLE_FMT_S64);
+    printf("s64: %s\n", c ? "accepted" : "refused");
+    ret |= !!c;
+    av_free(c);
+
+    return ret;
+}
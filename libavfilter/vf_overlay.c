@@ -43,6 +43,7 @@
 
 typedef struct ThreadData {
     AVFrame *dst, *src;
+    int x, y;                   ///< position of src in dst
 } ThreadData;
 
 static const char *const var_names[] = {
@@ -83,6 +84,7 @@ static av_cold void uninit(AVFilterContext *ctx)
     OverlayContext *s = ctx->priv;
 
     ff_framesync_uninit(&s->fs);
+    av_frame_free(&s->overlay_bbox);
     av_expr_free(s->x_pexpr); s->x_pexpr = NULL;
     av_expr_free(s->y_pexpr); s->y_pexpr = NULL;
 }
@@ -657,161 +659,141 @@ static av_always_inline void blend_slice_planar_rgb(AVFilterContext *ctx,
 
 static int blend_slice_yuv420(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_yuv(ctx, td->dst, td->src, 1, 1, 0, s->x, s->y, 1, jobnr, nb_jobs);
+    blend_slice_yuv(ctx, td->dst, td->src, 1, 1, 0, td->x, td->y, 1, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_yuva420(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_yuv(ctx, td->dst, td->src, 1, 1, 1, s->x, s->y, 1, jobnr, nb_jobs);
+    blend_slice_yuv(ctx, td->dst, td->src, 1, 1, 1, td->x, td->y, 1, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_yuv422(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_yuv(ctx, td->dst, td->src, 1, 0, 0, s->x, s->y, 1, jobnr, nb_jobs);
+    blend_slice_yuv(ctx, td->dst, td->src, 1, 0, 0, td->x, td->y, 1, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_yuva422(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_yuv(ctx, td->dst, td->src, 1, 0, 1, s->x, s->y, 1, jobnr, nb_jobs);
+    blend_slice_yuv(ctx, td->dst, td->src, 1, 0, 1, td->x, td->y, 1, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_yuv444(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_yuv(ctx, td->dst, td->src, 0, 0, 0, s->x, s->y, 1, jobnr, nb_jobs);
+    blend_slice_yuv(ctx, td->dst, td->src, 0, 0, 0, td->x, td->y, 1, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_yuva444(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_yuv(ctx, td->dst, td->src, 0, 0, 1, s->x, s->y, 1, jobnr, nb_jobs);
+    blend_slice_yuv(ctx, td->dst, td->src, 0, 0, 1, td->x, td->y, 1, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_gbrp(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_planar_rgb(ctx, td->dst, td->src, 0, 0, 0, s->x, s->y, 1, jobnr, nb_jobs);
+    blend_slice_planar_rgb(ctx, td->dst, td->src, 0, 0, 0, td->x, td->y, 1, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_gbrap(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_planar_rgb(ctx, td->dst, td->src, 0, 0, 1, s->x, s->y, 1, jobnr, nb_jobs);
+    blend_slice_planar_rgb(ctx, td->dst, td->src, 0, 0, 1, td->x, td->y, 1, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_yuv420_pm(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_yuv(ctx, td->dst, td->src, 1, 1, 0, s->x, s->y, 0, jobnr, nb_jobs);
+    blend_slice_yuv(ctx, td->dst, td->src, 1, 1, 0, td->x, td->y, 0, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_yuva420_pm(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_yuv(ctx, td->dst, td->src, 1, 1, 1, s->x, s->y, 0, jobnr, nb_jobs);
+    blend_slice_yuv(ctx, td->dst, td->src, 1, 1, 1, td->x, td->y, 0, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_yuv422_pm(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_yuv(ctx, td->dst, td->src, 1, 0, 0, s->x, s->y, 0, jobnr, nb_jobs);
+    blend_slice_yuv(ctx, td->dst, td->src, 1, 0, 0, td->x, td->y, 0, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_yuva422_pm(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_yuv(ctx, td->dst, td->src, 1, 0, 1, s->x, s->y, 0, jobnr, nb_jobs);
+    blend_slice_yuv(ctx, td->dst, td->src, 1, 0, 1, td->x, td->y, 0, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_yuv444_pm(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_yuv(ctx, td->dst, td->src, 0, 0, 0, s->x, s->y, 0, jobnr, nb_jobs);
+    blend_slice_yuv(ctx, td->dst, td->src, 0, 0, 0, td->x, td->y, 0, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_yuva444_pm(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_yuv(ctx, td->dst, td->src, 0, 0, 1, s->x, s->y, 0, jobnr, nb_jobs);
+    blend_slice_yuv(ctx, td->dst, td->src, 0, 0, 1, td->x, td->y, 0, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_gbrp_pm(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_planar_rgb(ctx, td->dst, td->src, 0, 0, 0, s->x, s->y, 0, jobnr, nb_jobs);
+    blend_slice_planar_rgb(ctx, td->dst, td->src, 0, 0, 0, td->x, td->y, 0, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_gbrap_pm(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_planar_rgb(ctx, td->dst, td->src, 0, 0, 1, s->x, s->y, 0, jobnr, nb_jobs);
+    blend_slice_planar_rgb(ctx, td->dst, td->src, 0, 0, 1, td->x, td->y, 0, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_rgb(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_packed_rgb(ctx, td->dst, td->src, 0, s->x, s->y, 1, jobnr, nb_jobs);
+    blend_slice_packed_rgb(ctx, td->dst, td->src, 0, td->x, td->y, 1, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_rgba(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_packed_rgb(ctx, td->dst, td->src, 1, s->x, s->y, 1, jobnr, nb_jobs);
+    blend_slice_packed_rgb(ctx, td->dst, td->src, 1, td->x, td->y, 1, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_rgb_pm(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_packed_rgb(ctx, td->dst, td->src, 0, s->x, s->y, 0, jobnr, nb_jobs);
+    blend_slice_packed_rgb(ctx, td->dst, td->src, 0, td->x, td->y, 0, jobnr, nb_jobs);
     return 0;
 }
 
 static int blend_slice_rgba_pm(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    OverlayContext *s = ctx->priv;
     ThreadData *td = arg;
-    blend_slice_packed_rgb(ctx, td->dst, td->src, 1, s->x, s->y, 0, jobnr, nb_jobs);
+    blend_slice_packed_rgb(ctx, td->dst, td->src, 1, td->x, td->y, 0, jobnr, nb_jobs);
     return 0;
 }
 
@@ -927,6 +909,57 @@ end:
     return 0;
 }
 
+/**
+ * Restrict the blend to the part of the overlay picture that ffmpeg's
+ * sub2video marks as not fully transparent. ffmpeg only sets the box when
+ * its canvas goes straight into this input, so nothing can have moved the
+ * pixels in between; the frame size it was computed for is checked anyway.
+ *
+ * @return 0 if nothing is to be blended, 1 otherwise
+ */
+static int crop_to_alpha_bbox(OverlayContext *s, ThreadData *td)
+{
+    AVFrame *src = td->src, *view = s->overlay_bbox;
+    AVDictionaryEntry *e;
+    int box[6], x, y, w, h, i;
+
+    /* premultiplied overlays may still add to the transparent pixels */
+    if (!s->overlay_has_alpha || s->alpha_format ||
+        !(e = av_dict_get(src->metadata, "lavfi.sub2video.bbox", NULL, 0)) ||
+        sscanf(e->value, "%d %d %d %d %d %d", &box[0], &box[1], &box[2], &box[3], &box[4], &box[5]) != 6)
+        return 1;
+    if (box[4] != src->width || box[5] != src->height)
+        return 1;
+    if (box[2] <= 0 || box[3] <= 0)
+        return 0;
+    if (box[0] < 0 || box[1] < 0 || box[0] >= src->width || box[1] >= src->height)
+        return 1;
+
+    /* Round to whole chroma samples and keep one transparent chroma sample
+       past the end, the chroma alpha being averaged differently on the
+       last row and column of the overlay. */
+    x = box[0] & ~((1 << s->hsub) - 1);
+    y = box[1] & ~((1 << s->vsub) - 1);
+    w = FFMIN(FFALIGN(box[0] + box[2], 1 << s->hsub) + (s->hsub ? 1 << s->hsub : 0), src->width)  - x;
+    h = FFMIN(FFALIGN(box[1] + box[3], 1 << s->vsub) + (s->vsub ? 1 << s->vsub : 0), src->height) - y;
+
+    view->format = src->format;
+    view->width  = w;
+    view->height = h;
+    for (i = 0; i < 4; i++) {
+        int hsub = i == 1 || i == 2 ? s->hsub : 0;
+        int vsub = i == 1 || i == 2 ? s->vsub : 0;
+
+        view->linesize[i] = src->linesize[i];
+        view->data[i]     = src->data[i] ? src->data[i] + (y >> vsub) * src->linesize[i] +
+                                           (x >> hsub) * s->overlay_pix_step[i] : NULL;
+    }
+    td->src = view;
+    td->x  += x;
+    td->y  += y;
+    return 1;
+}
+
 static int do_blend(FFFrameSync *fs)
 {
     AVFilterContext *ctx = fs->parent;
@@ -967,8 +1000,13 @@ static int do_blend(FFFrameSync *fs)
 
         td.dst = mainpic;
         td.src = second;
-        ctx->internal->execute(ctx, s->blend_slice, &td, NULL, FFMIN(FFMAX(1, FFMIN3(s->y + second->height, FFMIN(second->height, mainpic->height), mainpic->height - s->y)),
-                                                                     ff_filter_get_nb_threads(ctx)));
+        td.x   = s->x;
+        td.y   = s->y;
+        if (crop_to_alpha_bbox(s, &td) &&
+            td.x < mainpic->width  && td.x + td.src->width  >= 0 &&
+            td.y < mainpic->height && td.y + td.src->height >= 0)
+            ctx->internal->execute(ctx, s->blend_slice, &td, NULL, FFMIN(FFMAX(1, FFMIN3(td.y + td.src->height, FFMIN(td.src->height, mainpic->height), mainpic->height - td.y)),
+                                                                         ff_filter_get_nb_threads(ctx)));
     }
     return ff_filter_frame(ctx->outputs[0], mainpic);
 }
@@ -977,6 +1015,10 @@ static av_cold int init(AVFilterContext *ctx)
 {
     OverlayContext *s = ctx->priv;
 
+    s->overlay_bbox = av_frame_alloc();
+    if (!s->overlay_bbox)
+        return AVERROR(ENOMEM);
+
     s->fs.on_event = do_blend;
     return 0;
 }
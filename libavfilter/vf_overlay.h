@@ -69,6 +69,7 @@ typedef struct OverlayContext {
     int overlay_pix_step[4];    ///< steps per pixel for each plane of the overlay
     int hsub, vsub;             ///< chroma subsampling values
     const AVPixFmtDescriptor *main_desc; ///< format descriptor for main input
+    AVFrame *overlay_bbox;      ///< part of the overlay picture to blend, no buffers of its own
 
     double var_values[VAR_VARS_NB];
     char *x_expr, *y_expr;
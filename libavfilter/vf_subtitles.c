@@ -60,6 +60,10 @@ typedef struct AssContext {
     int original_w, original_h;
     int shaping;
     FFDrawContext draw;
+    AVFrame *layer;             ///< subtitles blended over zero, i.e. premultiplied by their coverage
+    AVFrame *layer_alpha;       ///< coverage of each byte of layer
+    int layer_x, layer_y;       ///< position of the layer in the video
+    int layer_valid;            ///< layer matches the last images returned by libass
 } AssContext;
 
 #define OFFSET(x) offsetof(AssContext, x)
@@ -118,6 +122,11 @@ static av_cold int init(AVFilterContext *ctx)
         return AVERROR(EINVAL);
     }
 
+    ass->layer       = av_frame_alloc();
+    ass->layer_alpha = av_frame_alloc();
+    if (!ass->layer || !ass->layer_alpha)
+        return AVERROR(ENOMEM);
+
     return 0;
 }
 
@@ -131,6 +140,8 @@ static av_cold void uninit(AVFilterContext *ctx)
         ass_renderer_done(ass->renderer);
     if (ass->library)
         ass_library_done(ass->library);
+    av_frame_free(&ass->layer);
+    av_frame_free(&ass->layer_alpha);
 }
 
 static int query_formats(AVFilterContext *ctx)
@@ -175,6 +186,119 @@ static void overlay_ass_image(AssContext *ass, AVFrame *picref,
     }
 }
 
+/**
+ * Composite the images into a layer covering their bounding box, so that
+ * the video only needs one blend per frame as long as they do not change:
+ * blending a picture p with the images is p * (255 - layer_alpha) / 255 + layer.
+ * Only for 8-bit formats, where both are laid out like the picture.
+ */
+static int build_layer(AssContext *ass, AVFilterLink *inlink, const ASS_Image *image)
+{
+    const ASS_Image *img;
+    int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+    int plane, ret;
+
+    av_frame_unref(ass->layer);
+    av_frame_unref(ass->layer_alpha);
+
+    for (img = image; img; img = img->next) {
+        if (img->w <= 0 || img->h <= 0 || !AA(img->color))
+            continue;
+        x0 = FFMIN(x0, img->dst_x);
+        y0 = FFMIN(y0, img->dst_y);
+        x1 = FFMAX(x1, img->dst_x + img->w);
+        y1 = FFMAX(y1, img->dst_y + img->h);
+    }
+    x0 = ff_draw_round_to_sub(&ass->draw, 0, -1, FFMAX(x0, 0));
+    y0 = ff_draw_round_to_sub(&ass->draw, 1, -1, FFMAX(y0, 0));
+    x1 = FFMIN(x1, inlink->w);
+    y1 = FFMIN(y1, inlink->h);
+    if (x0 >= x1 || y0 >= y1)
+        return 0;
+
+    ass->layer_x = x0;
+    ass->layer_y = y0;
+    ass->layer->format = ass->layer_alpha->format = inlink->format;
+    ass->layer->width  = ass->layer_alpha->width  = x1 - x0;
+    ass->layer->height = ass->layer_alpha->height = y1 - y0;
+    if ((ret = av_frame_get_buffer(ass->layer, 0)) < 0 ||
+        (ret = av_frame_get_buffer(ass->layer_alpha, 0)) < 0)
+        return ret;
+    for (plane = 0; plane < ass->draw.nb_planes; plane++) {
+        int h = AV_CEIL_RSHIFT(y1 - y0, ass->draw.vsub[plane]);
+
+        memset(ass->layer->data[plane],       0, ass->layer->linesize[plane]       * h);
+        memset(ass->layer_alpha->data[plane], 0, ass->layer_alpha->linesize[plane] * h);
+    }
+
+    for (img = image; img; img = img->next) {
+        uint8_t rgba_color[] = {AR(img->color), AG(img->color), AB(img->color), AA(img->color)};
+        FFDrawColor color, coverage;
+
+        ff_draw_color(&ass->draw, &color, rgba_color);
+        coverage = color;
+        for (plane = 0; plane < MAX_PLANES; plane++)
+            memset(coverage.comp[plane].u8, 0xff, sizeof(coverage.comp[plane].u8));
+        ff_blend_mask(&ass->draw, &color,
+                      ass->layer->data, ass->layer->linesize,
+                      ass->layer->width, ass->layer->height,
+                      img->bitmap, img->stride, img->w, img->h,
+                      3, 0, img->dst_x - x0, img->dst_y - y0);
+        ff_blend_mask(&ass->draw, &coverage,
+                      ass->layer_alpha->data, ass->layer_alpha->linesize,
+                      ass->layer_alpha->width, ass->layer_alpha->height,
+                      img->bitmap, img->stride, img->w, img->h,
+                      3, 0, img->dst_x - x0, img->dst_y - y0);
+    }
+    return 0;
+}
+
+#define FAST_DIV255(x) ((((x) + 128) * 257) >> 16)
+
+/* Straight loop over bytes the compiler can vectorize; unused components
+   have zero coverage and color and are left untouched. */
+static void blend_layer_line(uint8_t *dst, const uint8_t *src,
+                             const uint8_t *alpha, int w)
+{
+    int x;
+
+    for (x = 0; x < w; x++)
+        dst[x] = FFMIN(src[x] + FAST_DIV255(dst[x] * (255 - alpha[x])), 255);
+}
+
+/* The planes do not depend on each other, each job blends a band of rows
+   of every plane. */
+static int blend_layer_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    AssContext *ass = ctx->priv;
+    AVFrame *picref = arg;
+    const AVFrame *layer = ass->layer, *alpha = ass->layer_alpha;
+    int plane, y;
+
+    for (plane = 0; plane < ass->draw.nb_planes; plane++) {
+        const int hsub = ass->draw.hsub[plane];
+        const int vsub = ass->draw.vsub[plane];
+        const int step = ass->draw.pixelstep[plane];
+        const int w = AV_CEIL_RSHIFT(layer->width,  hsub) * step;
+        const int h = AV_CEIL_RSHIFT(layer->height, vsub);
+        const int slice_start = (h *  jobnr     ) / nb_jobs;
+        const int slice_end   = (h * (jobnr + 1)) / nb_jobs;
+        uint8_t *dst = picref->data[plane] +
+                       ((ass->layer_y >> vsub) + slice_start) * picref->linesize[plane] +
+                       (ass->layer_x >> hsub) * step;
+        const uint8_t *src = layer->data[plane] + slice_start * layer->linesize[plane];
+        const uint8_t *a   = alpha->data[plane] + slice_start * alpha->linesize[plane];
+
+        for (y = slice_start; y < slice_end; y++) {
+            blend_layer_line(dst, src, a, w);
+            dst += picref->linesize[plane];
+            src += layer->linesize[plane];
+            a   += alpha->linesize[plane];
+        }
+    }
+    return 0;
+}
+
 static int filter_frame(AVFilterLink *inlink, AVFrame *picref)
 {
     AVFilterContext *ctx = inlink->dst;
@@ -184,11 +308,27 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *picref)
     double time_ms = picref->pts * av_q2d(inlink->time_base) * 1000;
     ASS_Image *image = ass_render_frame(ass->renderer, ass->track,
                                         time_ms, &detect_change);
+    int ret;
 
     if (detect_change)
         av_log(ctx, AV_LOG_DEBUG, "Change happened at time ms:%f\n", time_ms);
 
-    overlay_ass_image(ass, picref, image);
+    if (ass->draw.desc->comp[0].depth > 8) {
+        overlay_ass_image(ass, picref, image);
+        return ff_filter_frame(outlink, picref);
+    }
+
+    if (detect_change || !ass->layer_valid) {
+        ass->layer_valid = 0;
+        if ((ret = build_layer(ass, inlink, image)) < 0) {
+            av_frame_free(&picref);
+            return ret;
+        }
+        ass->layer_valid = 1;
+    }
+    if (ass->layer->buf[0])
+        ctx->internal->execute(ctx, blend_layer_slice, picref, NULL,
+                               FFMIN(ass->layer->height, ff_filter_get_nb_threads(ctx)));
 
     return ff_filter_frame(outlink, picref);
 }
@@ -256,6 +396,7 @@ AVFilter ff_vf_ass = {
     .inputs        = ass_inputs,
     .outputs       = ass_outputs,
     .priv_class    = &ass_class,
+    .flags         = AVFILTER_FLAG_SLICE_THREADS,
 };
 #endif
 
@@ -494,5 +635,6 @@ AVFilter ff_vf_subtitles = {
     .inputs        = ass_inputs,
     .outputs       = ass_outputs,
     .priv_class    = &subtitles_class,
+    .flags         = AVFILTER_FLAG_SLICE_THREADS,
 };
 #endif
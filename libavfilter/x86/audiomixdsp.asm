@@ -0,0 +1,166 @@
+;*****************************************************************************
+;* x86-optimized functions for saturating audio mixing
+;*
+;* This file is part of FFmpeg.
+;*
+;* FFmpeg is free software; you can redistribute it and/or
+;* modify it under the terms of the GNU Lesser General Public
+;* License as published by the Free Software Foundation; either
+;* version 2.1 of the License, or (at your option) any later version.
+;*
+;* FFmpeg is distributed in the hope that it will be useful,
+;* but WITHOUT ANY WARRANTY; without even the implied warranty of
+;* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;* Lesser General Public License for more details.
+;*
+;* You should have received a copy of the GNU Lesser General Public
+;* License along with FFmpeg; if not, write to the Free Software
+;* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+;******************************************************************************
+
+%include "libavutil/x86/x86util.asm"
+
+SECTION_RODATA 32
+
+pb_80:       times 32 db 0x80
+pd_7fffffff: times 8 dd 0x7fffffff
+ps_1:        times 8 dd 1.0
+ps_m1:       times 8 dd -1.0
+pd_1:        times 4 dq 1.0
+pd_m1:       times 4 dq -1.0
+
+SECTION .text
+
+; %1 = log2 of the sample size
+%macro MIX_LOOP_START 1
+%if %1
+    shl     lenq, %1
+%endif
+    add     dstq, lenq
+    add     srcq, lenq
+    neg     lenq
+ALIGN 16
+.loop:
+    movu    m0, [dstq + lenq]
+    movu    m1, [srcq + lenq]
+%endmacro
+
+%macro MIX_LOOP_END 0
+    movu    [dstq + lenq], m0
+    add     lenq, mmsize
+    jl .loop
+    RET
+%endmacro
+
+;------------------------------------------------------------------------------
+; void ff_mix_<fmt>(uint8_t *dst, const uint8_t *src, ptrdiff_t len)
+;------------------------------------------------------------------------------
+
+%macro MIX_U8 0
+cglobal mix_u8, 3,3,3, dst, src, len
+    mova    m2, [pb_80]
+    MIX_LOOP_START 0
+    pxor    m0, m2
+    pxor    m1, m2
+    paddsb  m0, m1
+    pxor    m0, m2
+    MIX_LOOP_END
+%endmacro
+
+%macro MIX_S16 0
+cglobal mix_s16, 3,3,2, dst, src, len
+    MIX_LOOP_START 1
+    paddsw  m0, m1
+    MIX_LOOP_END
+%endmacro
+
+; there is no saturating dword add, detect the overflow from the signs instead
+%macro MIX_S32 0
+cglobal mix_s32, 3,3,6, dst, src, len
+    mova    m5, [pd_7fffffff]
+    MIX_LOOP_START 2
+    paddd   m2, m0, m1
+    pxor    m3, m2, m0
+    pxor    m4, m2, m1
+    pand    m3, m4
+    psrad   m3, 31          ; -1 where the sum overflowed
+    psrad   m0, 31
+    pxor    m0, m5          ; INT32_MAX or INT32_MIN depending on the sign of dst
+    pand    m0, m3
+    pandn   m3, m2
+    por     m0, m3
+    MIX_LOOP_END
+%endmacro
+
+%macro MIX_FLT 0
+cglobal mix_flt, 3,3,4, dst, src, len
+    mova    m2, [ps_1]
+    mova    m3, [ps_m1]
+    MIX_LOOP_START 2
+    addps   m0, m1
+    minps   m0, m2
+    maxps   m0, m3
+    MIX_LOOP_END
+%endmacro
+
+;------------------------------------------------------------------------------
+; void ff_mix_scaled_flt(uint8_t *dst, const uint8_t *src, float gain, ptrdiff_t len)
+;------------------------------------------------------------------------------
+
+%macro MIX_SCALED_FLT 0
+%if UNIX64
+cglobal mix_scaled_flt, 3,3,5, dst, src, len
+%else
+cglobal mix_scaled_flt, 4,4,5, dst, src, gain, len
+%endif
+%if ARCH_X86_32
+    VBROADCASTSS m4, gainm
+%else
+%if WIN64
+    SWAP 0, 2
+%endif
+    shufps      xm0, xm0, 0
+%if cpuflag(avx)
+    vinsertf128  m0, m0, xm0, 1
+%endif
+    SWAP 0, 4
+%endif
+    mova    m2, [ps_1]
+    mova    m3, [ps_m1]
+    MIX_LOOP_START 2
+    mulps   m0, m4
+    addps   m0, m1
+    minps   m0, m2
+    maxps   m0, m3
+    MIX_LOOP_END
+%endmacro
+
+%macro MIX_DBL 0
+cglobal mix_dbl, 3,3,4, dst, src, len
+    mova    m2, [pd_1]
+    mova    m3, [pd_m1]
+    MIX_LOOP_START 3
+    addpd   m0, m1
+    minpd   m0, m2
+    maxpd   m0, m3
+    MIX_LOOP_END
+%endmacro
+
+INIT_XMM sse
+MIX_FLT
+MIX_SCALED_FLT
+INIT_XMM sse2
+MIX_U8
+MIX_S16
+MIX_S32
+MIX_DBL
+INIT_YMM avx
+MIX_FLT
+MIX_SCALED_FLT
+MIX_DBL
+%if HAVE_AVX2_EXTERNAL
+INIT_YMM avx2
+MIX_U8
+MIX_S16
+MIX_S32
+%endif
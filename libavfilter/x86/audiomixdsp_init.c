@@ -0,0 +1,82 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+#include "libavutil/attributes.h"
+#include "libavutil/cpu.h"
+#include "libavutil/x86/cpu.h"
+#include "libavfilter/audiomixdsp.h"
+
+#define MIX_FUNCS(fmt, opt) \
+void ff_mix_##fmt##_##opt(uint8_t *dst, const uint8_t *src, ptrdiff_t len)
+
+MIX_FUNCS(u8,  sse2);
+MIX_FUNCS(u8,  avx2);
+MIX_FUNCS(s16, sse2);
+MIX_FUNCS(s16, avx2);
+MIX_FUNCS(s32, sse2);
+MIX_FUNCS(s32, avx2);
+MIX_FUNCS(flt, sse);
+MIX_FUNCS(flt, avx);
+MIX_FUNCS(dbl, sse2);
+MIX_FUNCS(dbl, avx);
+
+void ff_mix_scaled_flt_sse(uint8_t *dst, const uint8_t *src, float gain, ptrdiff_t len);
+void ff_mix_scaled_flt_avx(uint8_t *dst, const uint8_t *src, float gain, ptrdiff_t len);
+
+av_cold void ff_audiomixdsp_init_x86(AVAudioMixDSPContext *c, enum AVSampleFormat sample_fmt)
+{
+    int cpu_flags = av_get_cpu_flags();
+
+    switch (av_get_packed_sample_fmt(sample_fmt)) {
+    case AV_SAMPLE_FMT_U8:
+        if (EXTERNAL_SSE2(cpu_flags))
+            c->mix = ff_mix_u8_sse2;
+        if (EXTERNAL_AVX2_FAST(cpu_flags))
+            c->mix = ff_mix_u8_avx2;
+        break;
+    case AV_SAMPLE_FMT_S16:
+        if (EXTERNAL_SSE2(cpu_flags))
+            c->mix = ff_mix_s16_sse2;
+        if (EXTERNAL_AVX2_FAST(cpu_flags))
+            c->mix = ff_mix_s16_avx2;
+        break;
+    case AV_SAMPLE_FMT_S32:
+        if (EXTERNAL_SSE2(cpu_flags))
+            c->mix = ff_mix_s32_sse2;
+        if (EXTERNAL_AVX2_FAST(cpu_flags))
+            c->mix = ff_mix_s32_avx2;
+        break;
+    case AV_SAMPLE_FMT_FLT:
+        if (EXTERNAL_SSE(cpu_flags)) {
+            c->mix        = ff_mix_flt_sse;
+            c->mix_scaled = ff_mix_scaled_flt_sse;
+        }
+        if (EXTERNAL_AVX_FAST(cpu_flags)) {
+            c->mix        = ff_mix_flt_avx;
+            c->mix_scaled = ff_mix_scaled_flt_avx;
+        }
+        break;
+    case AV_SAMPLE_FMT_DBL:
+        if (EXTERNAL_SSE2(cpu_flags))
+            c->mix = ff_mix_dbl_sse2;
+        if (EXTERNAL_AVX_FAST(cpu_flags))
+            c->mix = ff_mix_dbl_avx;
+        break;
+    }
+}
@@ -25,9 +25,26 @@
 #include "subtitles.h"
 #include "libavutil/bprint.h"
 #include "libavutil/intreadwrite.h"
+#include "libavutil/opt.h"
+
+struct event_info {
+    int32_t x1, x2, y1, y2;
+    int duration;
+    int64_t pts;
+    int64_t pos;
+};
 
 typedef struct {
+    const AVClass *class;
     FFDemuxSubtitlesQueue q;
+    int streaming;
+    int loaded;         ///< in streaming mode, every event has been read into q by a seek
+    /* parser state, kept across packets in streaming mode */
+    FFTextReader tr;
+    AVBPrint buf;
+    char line_cache[4096];
+    int has_event_info;
+    struct event_info ei;
 } SRTContext;
 
 static int srt_probe(const AVProbeData *p)
@@ -62,13 +79,6 @@ static int srt_probe(const AVProbeData *p)
     return 0;
 }
 
-struct event_info {
-    int32_t x1, x2, y1, y2;
-    int duration;
-    int64_t pts;
-    int64_t pos;
-};
-
 static int get_event_info(const char *line, struct event_info *ei)
 {
     int hh1, mm1, ss1, ms1;
@@ -123,32 +133,24 @@ static int add_event(FFDemuxSubtitlesQueue *q, AVBPrint *buf, char *line_cache,
     return 0;
 }
 
-static int srt_read_header(AVFormatContext *s)
+/**
+ * Parse the input until one more event is queued. An event is only complete
+ * once the timing line of the next one, or the end of the input, is read.
+ */
+static int srt_read_event(AVFormatContext *s)
 {
     SRTContext *srt = s->priv_data;
-    AVBPrint buf;
-    AVStream *st = avformat_new_stream(s, NULL);
-    int res = 0;
-    char line[4096], line_cache[4096];
-    int has_event_info = 0;
-    struct event_info ei;
-    FFTextReader tr;
-    ff_text_init_avio(s, &tr, s->pb);
-
-    if (!st)
-        return AVERROR(ENOMEM);
-    avpriv_set_pts_info(st, 64, 1, 1000);
-    st->codecpar->codec_type = AVMEDIA_TYPE_SUBTITLE;
-    st->codecpar->codec_id   = AV_CODEC_ID_SUBRIP;
-
-    av_bprint_init(&buf, 0, AV_BPRINT_SIZE_UNLIMITED);
-
-    line_cache[0] = 0;
-
-    while (!ff_text_eof(&tr)) {
+    FFTextReader *tr = &srt->tr;
+    AVBPrint *buf = &srt->buf;
+    char *line_cache = srt->line_cache;
+    char line[4096];
+    int nb_subs = srt->q.nb_subs;
+    int res;
+
+    while (!ff_text_eof(tr)) {
         struct event_info tmp_ei;
-        const int64_t pos = ff_text_pos(&tr);
-        ptrdiff_t len = ff_subtitles_read_line(&tr, line, sizeof(line));
+        const int64_t pos = ff_text_pos(tr);
+        ptrdiff_t len = ff_subtitles_read_line(tr, line, sizeof(line));
 
         if (len < 0)
             break;
@@ -159,13 +161,13 @@ static int srt_read_header(AVFormatContext *s)
         if (get_event_info(line, &tmp_ei) < 0) {
             char *pline;
 
-            if (!has_event_info)
+            if (!srt->has_event_info)
                 continue;
 
             if (line_cache[0]) {
                 /* We got some cache and a new line so we assume the cached
                  * line was actually part of the payload */
-                av_bprintf(&buf, "%s\n", line_cache);
+                av_bprintf(buf, "%s\n", line_cache);
                 line_cache[0] = 0;
             }
 
@@ -174,55 +176,123 @@ static int srt_read_header(AVFormatContext *s)
              * timing information... but we can't be sure of this yet, so we
              * cache it */
             if (strtol(line, &pline, 10) < 0 || line == pline)
-                av_bprintf(&buf, "%s\n", line);
+                av_bprintf(buf, "%s\n", line);
             else
                 strcpy(line_cache, line);
         } else {
-            if (has_event_info) {
+            if (srt->has_event_info) {
                 /* We have the information of previous event, append it to the
                  * queue. We insert the cached line if and only if the payload
                  * is empty and the cached line is not a standalone number. */
                 char *pline = NULL;
                 const int standalone_number = strtol(line_cache, &pline, 10) >= 0 && pline && !*pline;
-                res = add_event(&srt->q, &buf, line_cache, &ei, !buf.len && !standalone_number);
+                res = add_event(&srt->q, buf, line_cache, &srt->ei, !buf->len && !standalone_number);
                 if (res < 0)
-                    goto end;
+                    return res;
             } else {
-                has_event_info = 1;
+                srt->has_event_info = 1;
             }
             tmp_ei.pos = pos;
-            ei = tmp_ei;
+            srt->ei = tmp_ei;
+            /* events with an empty payload are not queued */
+            if (srt->q.nb_subs > nb_subs)
+                return 0;
         }
     }
 
     /* Append the last event. Here we force the cache to be flushed, because a
      * trailing number is more likely to be geniune (for example a copyright
      * date) and not the event index of an inexistant event */
-    if (has_event_info) {
-        res = add_event(&srt->q, &buf, line_cache, &ei, 1);
+    if (srt->has_event_info) {
+        srt->has_event_info = 0;
+        res = add_event(&srt->q, buf, line_cache, &srt->ei, 1);
         if (res < 0)
-            goto end;
+            return res;
     }
 
-    ff_subtitles_queue_finalize(s, &srt->q);
+    return srt->q.nb_subs > nb_subs ? 0 : AVERROR_EOF;
+}
+
+static void srt_reset(AVFormatContext *s)
+{
+    SRTContext *srt = s->priv_data;
 
-end:
-    if (res < 0)
+    ff_text_init_avio(s, &srt->tr, s->pb);
+    av_bprint_clear(&srt->buf);
+    srt->line_cache[0] = 0;
+    srt->has_event_info = 0;
+}
+
+/* the whole input in the queue, sorted */
+static int srt_read_all(AVFormatContext *s)
+{
+    SRTContext *srt = s->priv_data;
+    int res;
+
+    while ((res = srt_read_event(s)) >= 0)
+        ;
+    if (res != AVERROR_EOF) {
         ff_subtitles_queue_clean(&srt->q);
-    av_bprint_finalize(&buf, NULL);
+        return res;
+    }
+    srt->q.streaming = 0;
+    ff_subtitles_queue_finalize(s, &srt->q);
+
+    return 0;
+}
+
+static int srt_read_header(AVFormatContext *s)
+{
+    SRTContext *srt = s->priv_data;
+    AVStream *st = avformat_new_stream(s, NULL);
+    int res;
+
+    if (!st)
+        return AVERROR(ENOMEM);
+    avpriv_set_pts_info(st, 64, 1, 1000);
+    st->codecpar->codec_type = AVMEDIA_TYPE_SUBTITLE;
+    st->codecpar->codec_id   = AV_CODEC_ID_SUBRIP;
+
+    av_bprint_init(&srt->buf, 0, AV_BPRINT_SIZE_UNLIMITED);
+    srt_reset(s);
+
+    /* the events are read along with the packets */
+    if (srt->streaming) {
+        srt->q.streaming = 1;
+        return 0;
+    }
+
+    if ((res = srt_read_all(s)) < 0)
+        av_bprint_finalize(&srt->buf, NULL);
     return res;
 }
 
 static int srt_read_packet(AVFormatContext *s, AVPacket *pkt)
 {
     SRTContext *srt = s->priv_data;
-    return ff_subtitles_queue_read_packet(&srt->q, pkt);
+    return ff_subtitles_queue_read_packet_streaming(&srt->q, s, srt_read_event, pkt);
 }
 
 static int srt_read_seek(AVFormatContext *s, int stream_index,
                          int64_t min_ts, int64_t ts, int64_t max_ts, int flags)
 {
     SRTContext *srt = s->priv_data;
+    int ret;
+
+    /* seeking needs every event, start over and read them all. The queue
+     * is not complete either once the events read so far were sorted. */
+    if (srt->streaming && !srt->loaded) {
+        if (!(s->pb->seekable & AVIO_SEEKABLE_NORMAL))
+            return AVERROR(ENOSYS);
+        ff_subtitles_queue_clean(&srt->q);
+        if ((ret = avio_seek(s->pb, 0, SEEK_SET)) < 0)
+            return ret;
+        srt_reset(s);
+        if ((ret = srt_read_all(s)) < 0)
+            return ret;
+        srt->loaded = 1;
+    }
+
     return ff_subtitles_queue_seek(&srt->q, s, stream_index,
                                    min_ts, ts, max_ts, flags);
 }
@@ -231,9 +301,24 @@ static int srt_read_close(AVFormatContext *s)
 {
     SRTContext *srt = s->priv_data;
     ff_subtitles_queue_clean(&srt->q);
+    av_bprint_finalize(&srt->buf, NULL);
     return 0;
 }
 
+#define OFFSET(x) offsetof(SRTContext, x)
+static const AVOption srt_options[] = {
+    { "streaming", "return the events as they are read instead of loading the whole file first",
+      OFFSET(streaming), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
+    { NULL }
+};
+
+static const AVClass srt_demuxer_class = {
+    .class_name = "SRT demuxer",
+    .item_name  = av_default_item_name,
+    .option     = srt_options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
 AVInputFormat ff_srt_demuxer = {
     .name        = "srt",
     .long_name   = NULL_IF_CONFIG_SMALL("SubRip subtitle"),
@@ -243,4 +328,5 @@ AVInputFormat ff_srt_demuxer = {
     .read_packet = srt_read_packet,
     .read_seek2  = srt_read_seek,
     .read_close  = srt_read_close,
+    .priv_class  = &srt_demuxer_class,
 };
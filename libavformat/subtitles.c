@@ -108,6 +108,18 @@ int ff_text_peek_r8(FFTextReader *r)
     return c;
 }
 
+static void free_index(FFDemuxSubtitlesQueue *q)
+{
+    int i;
+
+    for (i = 0; i < q->nb_index; i++) {
+        av_freep(&q->index[i].subs);
+        av_freep(&q->index[i].end);
+    }
+    av_freep(&q->index);
+    q->nb_index = 0;
+}
+
 AVPacket *ff_subtitles_queue_insert(FFDemuxSubtitlesQueue *q,
                                     const uint8_t *event, size_t len, int merge)
 {
@@ -191,10 +203,69 @@ static void drop_dups(void *log_ctx, FFDemuxSubtitlesQueue *q)
     }
 }
 
+static int64_t sub_end(const AVPacket *sub)
+{
+    return sub->duration > 0 ? sub->pts + sub->duration : INT64_MIN;
+}
+
+static int build_index(FFDemuxSubtitlesQueue *q)
+{
+    int i, j, nb_streams = 0;
+
+    /* queues sorted by position are only indexed if that is also pts order */
+    for (i = 0; i < q->nb_subs; i++) {
+        if (q->subs[i].stream_index < 0 || (i && q->subs[i].pts < q->subs[i - 1].pts))
+            return 0;
+        nb_streams = FFMAX(nb_streams, q->subs[i].stream_index + 1);
+    }
+
+    q->index = av_mallocz_array(nb_streams + 1, sizeof(*q->index));
+    if (!q->index)
+        return AVERROR(ENOMEM);
+    q->nb_index = nb_streams + 1;
+
+    for (i = 0; i < q->nb_subs; i++)
+        q->index[q->subs[i].stream_index].size++;
+    q->index[nb_streams].size = q->nb_subs;
+    for (j = 0; j < q->nb_index; j++) {
+        FFDemuxSubtitlesIndex *idx = &q->index[j];
+        int nb = idx->size;
+
+        if (!nb)
+            continue;
+        for (idx->size = 1; idx->size < nb; idx->size <<= 1)
+            ;
+        idx->subs = av_malloc_array(nb, sizeof(*idx->subs));
+        idx->end  = av_malloc_array(2 * idx->size, sizeof(*idx->end));
+        if (!idx->subs || !idx->end)
+            return AVERROR(ENOMEM);
+    }
+    for (i = 0; i < q->nb_subs; i++) {
+        FFDemuxSubtitlesIndex *idx = &q->index[q->subs[i].stream_index];
+
+        idx->subs[idx->nb_subs++] = i;
+        q->index[nb_streams].subs[q->index[nb_streams].nb_subs++] = i;
+    }
+
+    /* the leaves hold the end time of each event, the nodes above the
+       largest one below them */
+    for (j = 0; j < q->nb_index; j++) {
+        FFDemuxSubtitlesIndex *idx = &q->index[j];
+
+        for (i = 0; i < idx->size; i++)
+            idx->end[idx->size + i] = i < idx->nb_subs ? sub_end(&q->subs[idx->subs[i]])
+                                                       : INT64_MIN;
+        for (i = idx->size - 1; i > 0; i--)
+            idx->end[i] = FFMAX(idx->end[2 * i], idx->end[2 * i + 1]);
+    }
+    return 0;
+}
+
 void ff_subtitles_queue_finalize(void *log_ctx, FFDemuxSubtitlesQueue *q)
 {
     int i;
 
+    free_index(q);
     if (!q->nb_subs)
         return;
 
@@ -207,6 +278,10 @@ void ff_subtitles_queue_finalize(void *log_ctx, FFDemuxSubtitlesQueue *q)
 
     if (!q->keep_duplicates)
         drop_dups(log_ctx, q);
+
+    /* without the index, seeking falls back to a linear search */
+    if (build_index(q) < 0)
+        free_index(q);
 }
 
 int ff_subtitles_queue_read_packet(FFDemuxSubtitlesQueue *q, AVPacket *pkt)
@@ -225,6 +300,69 @@ int ff_subtitles_queue_read_packet(FFDemuxSubtitlesQueue *q, AVPacket *pkt)
     return 0;
 }
 
+static int is_dup(const AVPacket *a, const AVPacket *b)
+{
+    return a->pts == b->pts && a->duration == b->duration &&
+           a->stream_index == b->stream_index && !strcmp(a->data, b->data);
+}
+
+int ff_subtitles_queue_read_packet_streaming(FFDemuxSubtitlesQueue *q, AVFormatContext *s,
+                                             int (*read_event)(AVFormatContext *s),
+                                             AVPacket *pkt)
+{
+    int ret;
+
+    if (!q->streaming)
+        return ff_subtitles_queue_read_packet(q, pkt);
+
+    /* the returned events are removed, so the pending ones start at 0 */
+    while (!q->eof && q->nb_subs < 2) {
+        AVPacket *prev, *last;
+
+        ret = read_event(s);
+        if (ret == AVERROR_EOF) {
+            q->eof = 1;
+            break;
+        }
+        if (ret < 0)
+            return ret;
+        if (q->nb_subs < 2)
+            continue;
+
+        prev = &q->subs[q->nb_subs - 2];
+        last = &q->subs[q->nb_subs - 1];
+        if (q->sort == SUB_SORT_TS_POS ? cmp_pkt_sub_ts_pos(prev, last) > 0
+                                       : cmp_pkt_sub_pos_ts(prev, last) > 0) {
+            av_log(s, AV_LOG_WARNING, "Subtitle events out of order, "
+                   "reading the rest of the input to sort them\n");
+            while ((ret = read_event(s)) >= 0)
+                ;
+            if (ret != AVERROR_EOF)
+                return ret;
+            q->streaming = 0;
+            q->eof = 1;
+            ff_subtitles_queue_finalize(s, q);
+            return ff_subtitles_queue_read_packet(q, pkt);
+        }
+        if (!q->keep_duplicates && is_dup(prev, last)) {
+            av_log(s, AV_LOG_WARNING, "Dropping a duplicated subtitle event\n");
+            av_packet_unref(last);
+            q->nb_subs--;
+        }
+    }
+
+    if (!q->nb_subs)
+        return AVERROR_EOF;
+    if (q->subs[0].duration < 0 && q->nb_subs > 1)
+        q->subs[0].duration = q->subs[1].pts - q->subs[0].pts;
+
+    av_packet_move_ref(pkt, &q->subs[0]);
+    pkt->dts = pkt->pts;
+    memmove(q->subs, q->subs + 1, (q->nb_subs - 1) * sizeof(*q->subs));
+    q->nb_subs--;
+    return 0;
+}
+
 static int search_sub_ts(const FFDemuxSubtitlesQueue *q, int64_t ts)
 {
     int s1 = 0, s2 = q->nb_subs - 1;
@@ -247,6 +385,75 @@ static int search_sub_ts(const FFDemuxSubtitlesQueue *q, int64_t ts)
     }
 }
 
+/* first position in the index of an event with a pts above ts, or >= ts if eq */
+static int index_search(const FFDemuxSubtitlesQueue *q, const FFDemuxSubtitlesIndex *idx,
+                        int64_t ts, int eq)
+{
+    int lo = 0, hi = idx->nb_subs;
+
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        int64_t pts = q->subs[idx->subs[mid]].pts;
+
+        if (pts < ts || (!eq && pts == ts))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* first position in [lo, hi) of an event ending after ts, -1 if none */
+static int index_search_end(const FFDemuxSubtitlesIndex *idx, int node,
+                            int node_lo, int node_hi, int lo, int hi, int64_t ts)
+{
+    int mid, ret;
+
+    if (node_hi <= lo || hi <= node_lo || idx->end[node] <= ts)
+        return -1;
+    if (node_hi - node_lo == 1)
+        return node_lo;
+    mid = (node_lo + node_hi) >> 1;
+    ret = index_search_end(idx, 2 * node, node_lo, mid, lo, hi, ts);
+    if (ret < 0)
+        ret = index_search_end(idx, 2 * node + 1, mid, node_hi, lo, hi, ts);
+    return ret;
+}
+
+static int index_seek(FFDemuxSubtitlesQueue *q, int stream_index,
+                      int64_t min_ts, int64_t ts, int64_t max_ts)
+{
+    const FFDemuxSubtitlesIndex *idx;
+    int64_t ts_selected;
+    int i, overlap;
+
+    if (stream_index >= q->nb_index - 1)
+        return AVERROR(ERANGE);
+    idx = &q->index[stream_index < 0 ? q->nb_index - 1 : stream_index];
+    if (!idx->nb_subs)
+        return AVERROR(ERANGE);
+
+    i = FFMAX(index_search(q, idx, ts, 0) - 1, 0);
+    ts_selected = q->subs[idx->subs[i]].pts;
+    if (ts_selected < min_ts || ts_selected > max_ts)
+        return AVERROR(ERANGE);
+
+    /* start with the earliest subtitle not before min_ts still shown at
+       the selected one */
+    overlap = index_search_end(idx, 1, 0, idx->size,
+                               index_search(q, idx, min_ts, 1), i, ts_selected);
+    if (overlap >= 0)
+        i = overlap;
+
+    /* with all the streams, take the first entry of a timestamp, i.e. the
+       one with the smallest file position */
+    if (stream_index == -1)
+        i = index_search(q, idx, q->subs[idx->subs[i]].pts, 1);
+
+    q->current_sub_idx = idx->subs[i];
+    return 0;
+}
+
 int ff_subtitles_queue_seek(FFDemuxSubtitlesQueue *q, AVFormatContext *s, int stream_index,
                             int64_t min_ts, int64_t ts, int64_t max_ts, int flags)
 {
@@ -256,6 +463,9 @@ int ff_subtitles_queue_seek(FFDemuxSubtitlesQueue *q, AVFormatContext *s, int st
         if (ts < 0 || ts >= q->nb_subs)
             return AVERROR(ERANGE);
         q->current_sub_idx = ts;
+    } else if (q->nb_index && q->index[q->nb_index - 1].nb_subs == q->nb_subs) {
+        /* unless events were inserted after the index was built */
+        return index_seek(q, stream_index, min_ts, ts, max_ts);
     } else {
         int i, idx = search_sub_ts(q, ts);
         int64_t ts_selected;
@@ -306,6 +516,7 @@ void ff_subtitles_queue_clean(FFDemuxSubtitlesQueue *q)
     for (i = 0; i < q->nb_subs; i++)
         av_packet_unref(&q->subs[i]);
     av_freep(&q->subs);
+    free_index(q);
     q->nb_subs = q->allocated_size = q->current_sub_idx = 0;
 }
 
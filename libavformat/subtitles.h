@@ -99,6 +99,13 @@ int ff_text_peek_r8(FFTextReader *r);
  */
 void ff_text_read(FFTextReader *r, char *buf, size_t size);
 
+typedef struct {
+    int *subs;              ///< positions in the queue of the events, in pts order
+    int nb_subs;            ///< number of events
+    int64_t *end;           ///< segment tree of the largest end time of the events
+    int size;               ///< number of leaves of the tree, a power of 2
+} FFDemuxSubtitlesIndex;
+
 typedef struct {
     AVPacket *subs;         ///< array of subtitles packets
     int nb_subs;            ///< number of subtitles packets
@@ -106,6 +113,10 @@ typedef struct {
     int current_sub_idx;    ///< current position for the read packet callback
     enum sub_sort sort;     ///< sort method to use when finalizing subtitles
     int keep_duplicates;    ///< set to 1 to keep duplicated subtitle events
+    int streaming;          ///< events are read on demand, see ff_subtitles_queue_read_packet_streaming()
+    int eof;                ///< no more events to read in streaming mode
+    FFDemuxSubtitlesIndex *index; ///< seek index of each stream_index, then of all of them
+    int nb_index;           ///< number of seek indexes, 0 if the queue is searched linearly
 } FFDemuxSubtitlesQueue;
 
 /**
@@ -120,8 +131,10 @@ AVPacket *ff_subtitles_queue_insert(FFDemuxSubtitlesQueue *q,
                                     const uint8_t *event, size_t len, int merge);
 
 /**
- * Set missing durations, sort subtitles by PTS (and then byte position), and
- * drop duplicated events.
+ * Set missing durations, sort subtitles by PTS (and then byte position), drop
+ * duplicated events and build the seek index. The events must not be changed
+ * afterwards. If more are inserted, seeking searches the queue linearly until
+ * it is finalized again.
  */
 void ff_subtitles_queue_finalize(void *log_ctx, FFDemuxSubtitlesQueue *q);
 
@@ -131,6 +144,20 @@ void ff_subtitles_queue_finalize(void *log_ctx, FFDemuxSubtitlesQueue *q);
  */
 int ff_subtitles_queue_read_packet(FFDemuxSubtitlesQueue *q, AVPacket *pkt);
 
+/**
+ * read_packet() callback for subtitles demuxers reading their events on
+ * demand instead of all of them in read_header(), with q->streaming set.
+ * Only one event is kept ahead of the returned one, to fill in its duration
+ * and drop duplicates. When an event is found out of order, the rest of the
+ * input is read and sorted as ff_subtitles_queue_finalize() would.
+ *
+ * @param read_event callback adding the next event(s) to q, returning
+ *                   AVERROR_EOF at the end of the input
+ */
+int ff_subtitles_queue_read_packet_streaming(FFDemuxSubtitlesQueue *q, AVFormatContext *s,
+                                             int (*read_event)(AVFormatContext *s),
+                                             AVPacket *pkt);
+
 /**
  * Update current_sub_idx to emulate a seek. Except the first parameter, it
  * matches AVInputFormat->read_seek2 prototypes.
@@ -0,0 +1,128 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "libavutil/common.h"
+#include "libavutil/lfg.h"
+#include "libavformat/subtitles.h"
+
+#define NB_SEEKS 2000
+
+/* linear reference of the seek done with the index */
+static int linear_seek(const FFDemuxSubtitlesQueue *q, int stream_index,
+                       int64_t min_ts, int64_t ts, int64_t max_ts)
+{
+    int i, first = -1, idx = -1;
+
+    /* the last event of the stream starting at ts or before, else its first one */
+    for (i = 0; i < q->nb_subs; i++) {
+        if (stream_index != -1 && q->subs[i].stream_index != stream_index)
+            continue;
+        if (first < 0)
+            first = i;
+        if (q->subs[i].pts <= ts)
+            idx = i;
+    }
+    if (first < 0)
+        return AVERROR(ERANGE);
+    if (idx < 0)
+        idx = first;
+    if (q->subs[idx].pts < min_ts || q->subs[idx].pts > max_ts)
+        return AVERROR(ERANGE);
+
+    /* the earliest event of the stream not before min_ts still shown at it */
+    for (i = 0; i < idx; i++) {
+        const AVPacket *sub = &q->subs[i];
+
+        if ((stream_index == -1 || sub->stream_index == stream_index) &&
+            sub->pts >= min_ts && sub->duration > 0 &&
+            sub->pts + sub->duration > q->subs[idx].pts) {
+            idx = i;
+            break;
+        }
+    }
+
+    if (stream_index == -1)
+        while (idx > 0 && q->subs[idx - 1].pts == q->subs[idx].pts)
+            idx--;
+
+    return idx;
+}
+
+/* nb_events cues of up to max_duration, spread over nb_streams streams */
+static int test_seek(AVLFG *lfg, int nb_events, int nb_streams, int max_duration)
+{
+    FFDemuxSubtitlesQueue q = { 0 };
+    int i, ret, mismatch = 0;
+
+    for (i = 0; i < nb_events; i++) {
+        char text[16];
+        int len = snprintf(text, sizeof(text), "%d", i);
+        AVPacket *sub = ff_subtitles_queue_insert(&q, (uint8_t *)text, len, 0);
+
+        if (!sub) {
+            ff_subtitles_queue_clean(&q);
+            return AVERROR(ENOMEM);
+        }
+        sub->pts          = av_lfg_get(lfg) % 1000;
+        sub->pos          = i;
+        sub->stream_index = av_lfg_get(lfg) % nb_streams;
+        /* one cue in ten has no duration, set from the next one */
+        sub->duration     = av_lfg_get(lfg) % 10 ? av_lfg_get(lfg) % max_duration + 1 : -1;
+    }
+    ff_subtitles_queue_finalize(NULL, &q);
+
+    for (i = 0; i < NB_SEEKS; i++) {
+        int stream_index = (int)(av_lfg_get(lfg) % (nb_streams + 1)) - 1;
+        int64_t ts = (int64_t)(av_lfg_get(lfg) % 1200) - 100;
+        int64_t min_ts = av_lfg_get(lfg) % 4 ? ts - av_lfg_get(lfg) % 500 : INT64_MIN;
+        int64_t max_ts = av_lfg_get(lfg) % 4 ? ts + av_lfg_get(lfg) % 500 : INT64_MAX;
+        int expected = linear_seek(&q, stream_index, min_ts, ts, max_ts);
+
+        q.current_sub_idx = -1;
+        ret = ff_subtitles_queue_seek(&q, NULL, stream_index, min_ts, ts, max_ts, 0);
+        if (ret >= 0)
+            ret = q.current_sub_idx;
+        if (ret != expected && mismatch++ < 10)
+            printf("stream %d ts %"PRId64" in [%"PRId64", %"PRId64"]: got %d, expected %d\n",
+                   stream_index, ts, min_ts, max_ts, ret, expected);
+    }
+
+    printf("%d events, %d streams, durations up to %d: %d of %d seeks mismatch\n",
+           nb_events, nb_streams, max_duration, mismatch, NB_SEEKS);
+    ff_subtitles_queue_clean(&q);
+    return mismatch ? 1 : 0;
+}
+
+int main(void)
+{
+    static const int nb_events[]    = { 1, 2, 7, 64, 1000 };
+    static const int max_duration[] = { 5, 100, 1000 };
+    AVLFG lfg;
+    int i, j, nb_streams, ret = 0;
+
+    av_lfg_init(&lfg, 0xdeadbeef);
+    for (i = 0; i < FF_ARRAY_ELEMS(nb_events); i++)
+        for (nb_streams = 1; nb_streams <= 3; nb_streams++)
+            for (j = 0; j < FF_ARRAY_ELEMS(max_duration); j++)
+                ret |= test_seek(&lfg, nb_events[i], nb_streams, max_duration[j]) != 0;
+
+    return ret;
+}
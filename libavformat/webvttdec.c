@@ -35,6 +35,9 @@ typedef struct {
     const AVClass *class;
     FFDemuxSubtitlesQueue q;
     int kind;
+    int streaming;
+    int loaded;         ///< in streaming mode, every cue has been read into q by a seek
+    AVBPrint cue;
 } WebVTTContext;
 
 static int webvtt_probe(const AVProbeData *p)
@@ -57,21 +60,11 @@ static int64_t read_ts(const char *s)
     return AV_NOPTS_VALUE;
 }
 
-static int webvtt_read_header(AVFormatContext *s)
+/* parse the input until one more cue is queued */
+static int webvtt_read_event(AVFormatContext *s)
 {
     WebVTTContext *webvtt = s->priv_data;
-    AVBPrint cue;
-    int res = 0;
-    AVStream *st = avformat_new_stream(s, NULL);
-
-    if (!st)
-        return AVERROR(ENOMEM);
-    avpriv_set_pts_info(st, 64, 1, 1000);
-    st->codecpar->codec_type = AVMEDIA_TYPE_SUBTITLE;
-    st->codecpar->codec_id   = AV_CODEC_ID_WEBVTT;
-    st->disposition |= webvtt->kind;
-
-    av_bprint_init(&cue,    0, AV_BPRINT_SIZE_UNLIMITED);
+    AVBPrint *cue = &webvtt->cue;
 
     for (;;) {
         int i;
@@ -81,12 +74,12 @@ static int webvtt_read_header(AVFormatContext *s)
         int identifier_len, settings_len;
         int64_t ts_start, ts_end;
 
-        ff_subtitles_read_chunk(s->pb, &cue);
+        ff_subtitles_read_chunk(s->pb, cue);
 
-        if (!cue.len)
-            break;
+        if (!cue->len)
+            return AVERROR_EOF;
 
-        p = identifier = cue.str;
+        p = identifier = cue->str;
         pos = avio_tell(s->pb);
 
         /* ignore header chunk */
@@ -114,15 +107,15 @@ static int webvtt_read_header(AVFormatContext *s)
                 p++;
         }
 
-        /* cue timestamps */
+        /* cue timestamps, anything else ends the parsing */
         if ((ts_start = read_ts(p)) == AV_NOPTS_VALUE)
-            break;
+            return AVERROR_EOF;
         if (!(p = strstr(p, "-->")))
-            break;
+            return AVERROR_EOF;
         p += 2;
         do p++; while (*p == ' ' || *p == '\t');
         if ((ts_end = read_ts(p)) == AV_NOPTS_VALUE)
-            break;
+            return AVERROR_EOF;
 
         /* optional cue settings */
         p += strcspn(p, "\n\t ");
@@ -138,10 +131,8 @@ static int webvtt_read_header(AVFormatContext *s)
 
         /* create packet */
         sub = ff_subtitles_queue_insert(&webvtt->q, p, strlen(p), 0);
-        if (!sub) {
-            res = AVERROR(ENOMEM);
-            goto end;
-        }
+        if (!sub)
+            return AVERROR(ENOMEM);
         sub->pos = pos;
         sub->pts = ts_start;
         sub->duration = ts_end - ts_start;
@@ -149,37 +140,86 @@ static int webvtt_read_header(AVFormatContext *s)
 #define SET_SIDE_DATA(name, type) do {                                  \
     if (name##_len) {                                                   \
         uint8_t *buf = av_packet_new_side_data(sub, type, name##_len);  \
-        if (!buf) {                                                     \
-            res = AVERROR(ENOMEM);                                      \
-            goto end;                                                   \
-        }                                                               \
+        if (!buf)                                                       \
+            return AVERROR(ENOMEM);                                     \
         memcpy(buf, name, name##_len);                                  \
     }                                                                   \
 } while (0)
 
         SET_SIDE_DATA(identifier, AV_PKT_DATA_WEBVTT_IDENTIFIER);
         SET_SIDE_DATA(settings,   AV_PKT_DATA_WEBVTT_SETTINGS);
+        return 0;
     }
+}
 
-    ff_subtitles_queue_finalize(s, &webvtt->q);
+/* the whole input in the queue, sorted */
+static int webvtt_read_all(AVFormatContext *s)
+{
+    WebVTTContext *webvtt = s->priv_data;
+    int res;
 
-end:
-    if (res < 0)
+    while ((res = webvtt_read_event(s)) >= 0)
+        ;
+    if (res != AVERROR_EOF) {
         ff_subtitles_queue_clean(&webvtt->q);
-    av_bprint_finalize(&cue,    NULL);
+        return res;
+    }
+    webvtt->q.streaming = 0;
+    ff_subtitles_queue_finalize(s, &webvtt->q);
+
+    return 0;
+}
+
+static int webvtt_read_header(AVFormatContext *s)
+{
+    WebVTTContext *webvtt = s->priv_data;
+    int res;
+    AVStream *st = avformat_new_stream(s, NULL);
+
+    if (!st)
+        return AVERROR(ENOMEM);
+    avpriv_set_pts_info(st, 64, 1, 1000);
+    st->codecpar->codec_type = AVMEDIA_TYPE_SUBTITLE;
+    st->codecpar->codec_id   = AV_CODEC_ID_WEBVTT;
+    st->disposition |= webvtt->kind;
+
+    av_bprint_init(&webvtt->cue, 0, AV_BPRINT_SIZE_UNLIMITED);
+
+    /* the cues are read along with the packets */
+    if (webvtt->streaming) {
+        webvtt->q.streaming = 1;
+        return 0;
+    }
+
+    if ((res = webvtt_read_all(s)) < 0)
+        av_bprint_finalize(&webvtt->cue, NULL);
     return res;
 }
 
 static int webvtt_read_packet(AVFormatContext *s, AVPacket *pkt)
 {
     WebVTTContext *webvtt = s->priv_data;
-    return ff_subtitles_queue_read_packet(&webvtt->q, pkt);
+    return ff_subtitles_queue_read_packet_streaming(&webvtt->q, s, webvtt_read_event, pkt);
 }
 
 static int webvtt_read_seek(AVFormatContext *s, int stream_index,
                             int64_t min_ts, int64_t ts, int64_t max_ts, int flags)
 {
     WebVTTContext *webvtt = s->priv_data;
+    int ret;
+
+    /* seeking needs every cue, start over and read them all. The queue
+     * is not complete either once the cues read so far were sorted. */
+    if (webvtt->streaming && !webvtt->loaded) {
+        if (!(s->pb->seekable & AVIO_SEEKABLE_NORMAL))
+            return AVERROR(ENOSYS);
+        ff_subtitles_queue_clean(&webvtt->q);
+        if ((ret = avio_seek(s->pb, 0, SEEK_SET)) < 0 ||
+            (ret = webvtt_read_all(s)) < 0)
+            return ret;
+        webvtt->loaded = 1;
+    }
+
     return ff_subtitles_queue_seek(&webvtt->q, s, stream_index,
                                    min_ts, ts, max_ts, flags);
 }
@@ -188,6 +228,7 @@ static int webvtt_read_close(AVFormatContext *s)
 {
     WebVTTContext *webvtt = s->priv_data;
     ff_subtitles_queue_clean(&webvtt->q);
+    av_bprint_finalize(&webvtt->cue, NULL);
     return 0;
 }
 
@@ -200,6 +241,8 @@ static const AVOption options[] = {
         { "captions",     "WebVTT captions kind",     0, AV_OPT_TYPE_CONST, { .i64 = AV_DISPOSITION_CAPTIONS },     INT_MIN, INT_MAX, KIND_FLAGS, "webvtt_kind" },
         { "descriptions", "WebVTT descriptions kind", 0, AV_OPT_TYPE_CONST, { .i64 = AV_DISPOSITION_DESCRIPTIONS }, INT_MIN, INT_MAX, KIND_FLAGS, "webvtt_kind" },
         { "metadata",     "WebVTT metadata kind",     0, AV_OPT_TYPE_CONST, { .i64 = AV_DISPOSITION_METADATA },     INT_MIN, INT_MAX, KIND_FLAGS, "webvtt_kind" },
+    { "streaming", "return the cues as they are read instead of loading the whole file first",
+      OFFSET(streaming), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
     { NULL }
 };
 
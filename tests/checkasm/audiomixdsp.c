@@ -0,0 +1,146 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <float.h>
+#include <limits.h>
+#include <string.h>
+
+#include "libavfilter/audiomixdsp.h"
+#include "libavutil/internal.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/mem.h"
+#include "checkasm.h"
+
+#define LEN 1024
+/* mix from an odd sample offset, the callers do not keep the buffers aligned */
+#define OFFSET 1
+#define BUF_SIZE ((LEN + OFFSET) * sizeof(double))
+
+static void randomize_buffer(uint8_t *buf, enum AVSampleFormat fmt)
+{
+    int i;
+
+    switch (fmt) {
+    case AV_SAMPLE_FMT_FLT:
+        for (i = 0; i < LEN + OFFSET; i++)
+            ((float *)buf)[i] = (float)rnd() / UINT_MAX * 3.0f - 1.5f;
+        break;
+    case AV_SAMPLE_FMT_DBL:
+        for (i = 0; i < LEN + OFFSET; i++)
+            ((double *)buf)[i] = (double)rnd() / UINT_MAX * 3.0 - 1.5;
+        break;
+    default:
+        for (i = 0; i < BUF_SIZE; i += 4)
+            AV_WN32A(buf + i, rnd());
+        break;
+    }
+}
+
+static void check_mix(enum AVSampleFormat fmt, const char *name)
+{
+    LOCAL_ALIGNED_32(uint8_t, src, [BUF_SIZE]);
+    LOCAL_ALIGNED_32(uint8_t, dst_ref, [BUF_SIZE]);
+    LOCAL_ALIGNED_32(uint8_t, dst_new, [BUF_SIZE]);
+    AVAudioMixDSPContext c;
+    int bps = av_get_bytes_per_sample(fmt);
+    int len;
+
+    declare_func(void, uint8_t *dst, const uint8_t *src, ptrdiff_t len);
+
+    if (ff_audiomixdsp_init(&c, fmt) < 0) {
+        fail();
+        return;
+    }
+
+    if (check_func(c.mix, "mix_%s", name)) {
+        randomize_buffer(src, fmt);
+        randomize_buffer(dst_ref, fmt);
+        memcpy(dst_new, dst_ref, BUF_SIZE);
+
+        for (len = 32; len <= LEN; len += 32 * 7) {
+            call_ref(dst_ref + OFFSET * bps, src + OFFSET * bps, len);
+            call_new(dst_new + OFFSET * bps, src + OFFSET * bps, len);
+            if (memcmp(dst_ref, dst_new, BUF_SIZE))
+                fail();
+        }
+        bench_new(dst_new + OFFSET * bps, src + OFFSET * bps, LEN);
+    }
+}
+
+static int buffers_differ(const uint8_t *a, const uint8_t *b, enum AVSampleFormat fmt)
+{
+    switch (fmt) {
+    case AV_SAMPLE_FMT_FLT:
+        return !float_near_abs_eps_array((const float *)a, (const float *)b,
+                                         FLT_EPSILON, LEN + OFFSET);
+    case AV_SAMPLE_FMT_DBL:
+        return !double_near_abs_eps_array((const double *)a, (const double *)b,
+                                          DBL_EPSILON, LEN + OFFSET);
+    default:
+        return memcmp(a, b, BUF_SIZE);
+    }
+}
+
+static void check_mix_scaled(enum AVSampleFormat fmt, const char *name)
+{
+    LOCAL_ALIGNED_32(uint8_t, src, [BUF_SIZE]);
+    LOCAL_ALIGNED_32(uint8_t, dst_ref, [BUF_SIZE]);
+    LOCAL_ALIGNED_32(uint8_t, dst_new, [BUF_SIZE]);
+    AVAudioMixDSPContext c;
+    int bps = av_get_bytes_per_sample(fmt);
+    float gain = (float)rnd() / UINT_MAX;
+    int len;
+
+    declare_func(void, uint8_t *dst, const uint8_t *src, float gain, ptrdiff_t len);
+
+    if (ff_audiomixdsp_init(&c, fmt) < 0) {
+        fail();
+        return;
+    }
+
+    if (check_func(c.mix_scaled, "mix_scaled_%s", name)) {
+        randomize_buffer(src, fmt);
+        randomize_buffer(dst_ref, fmt);
+        memcpy(dst_new, dst_ref, BUF_SIZE);
+
+        for (len = 32; len <= LEN; len += 32 * 7) {
+            call_ref(dst_ref + OFFSET * bps, src + OFFSET * bps, gain, len);
+            call_new(dst_new + OFFSET * bps, src + OFFSET * bps, gain, len);
+            if (buffers_differ(dst_ref, dst_new, fmt))
+                fail();
+        }
+        bench_new(dst_new + OFFSET * bps, src + OFFSET * bps, gain, LEN);
+    }
+}
+
+void checkasm_check_audiomixdsp(void)
+{
+    check_mix(AV_SAMPLE_FMT_U8,  "u8");
+    check_mix(AV_SAMPLE_FMT_S16, "s16");
+    check_mix(AV_SAMPLE_FMT_S32, "s32");
+    check_mix(AV_SAMPLE_FMT_FLT, "flt");
+    check_mix(AV_SAMPLE_FMT_DBL, "dbl");
+    report("mix");
+
+    check_mix_scaled(AV_SAMPLE_FMT_U8,  "u8");
+    check_mix_scaled(AV_SAMPLE_FMT_S16, "s16");
+    check_mix_scaled(AV_SAMPLE_FMT_S32, "s32");
+    check_mix_scaled(AV_SAMPLE_FMT_FLT, "flt");
+    check_mix_scaled(AV_SAMPLE_FMT_DBL, "dbl");
+    report("mix_scaled");
+}
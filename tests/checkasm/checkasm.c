@@ -159,6 +159,7 @@ static const struct {
     #if CONFIG_AFIR_FILTER
         { "af_afir", checkasm_check_afir },
     #endif
+        { "audiomixdsp", checkasm_check_audiomixdsp },
     #if CONFIG_BLEND_FILTER
         { "vf_blend", checkasm_check_blend },
     #endif
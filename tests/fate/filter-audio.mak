@@ -393,6 +393,10 @@ fate-filter-hdcd-s32p: CMD = md5 -i $(SRC) -af hdcd -f s32le
 fate-filter-hdcd-s32p: CMP = oneline
 fate-filter-hdcd-s32p: REF = 0c5513e83eedaa10ab6fac9ddc173cf5
 
+FATE_AFILTER-yes += fate-filter-audiomixdsp
+fate-filter-audiomixdsp: libavfilter/tests/audiomixdsp$(EXESUF)
+fate-filter-audiomixdsp: CMD = run libavfilter/tests/audiomixdsp$(EXESUF)
+
 FATE_AFILTER-yes += fate-filter-formats
 fate-filter-formats: libavfilter/tests/formats$(EXESUF)
 fate-filter-formats: CMD = run libavfilter/tests/formats$(EXESUF)
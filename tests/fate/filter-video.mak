@@ -233,6 +233,16 @@ fate-filter-overlay_nv21: tests/data/filtergraphs/overlay_nv21
 fate-filter-overlay_nv21: CMD = framecrc -c:v pgmyuv -i $(SRC) -filter_complex_script $(TARGET_PATH)/tests/data/filtergraphs/overlay_nv21
 fate-filter-overlay_nv21: REF = $(SRC_PATH)/tests/ref/fate/filter-overlay_yuv420
 
+# the region marked by sub2video must blend exactly like the whole picture
+FATE_FILTER_VSYNTH-$(call ALLYES, SPLIT_FILTER SCALE_FILTER FORMAT_FILTER PAD_FILTER METADATA_FILTER OVERLAY_FILTER) += fate-filter-overlay_bbox
+fate-filter-overlay_bbox: tests/data/filtergraphs/overlay_bbox
+fate-filter-overlay_bbox: CMD = framecrc -c:v pgmyuv -i $(SRC) -filter_complex_script $(TARGET_PATH)/tests/data/filtergraphs/overlay_bbox
+fate-filter-overlay_bbox: REF = $(SRC_PATH)/tests/ref/fate/filter-overlay_bbox_full
+
+FATE_FILTER_VSYNTH-$(call ALLYES, SPLIT_FILTER SCALE_FILTER FORMAT_FILTER PAD_FILTER OVERLAY_FILTER) += fate-filter-overlay_bbox_full
+fate-filter-overlay_bbox_full: tests/data/filtergraphs/overlay_bbox_full
+fate-filter-overlay_bbox_full: CMD = framecrc -c:v pgmyuv -i $(SRC) -filter_complex_script $(TARGET_PATH)/tests/data/filtergraphs/overlay_bbox_full
+
 FATE_FILTER_VSYNTH-$(call ALLYES, SPLIT_FILTER SCALE_FILTER PAD_FILTER OVERLAY_FILTER) += fate-filter-overlay_yuv422
 fate-filter-overlay_yuv422: tests/data/filtergraphs/overlay_yuv422
 fate-filter-overlay_yuv422: CMD = framecrc -c:v pgmyuv -i $(SRC) -filter_complex_script $(TARGET_PATH)/tests/data/filtergraphs/overlay_yuv422
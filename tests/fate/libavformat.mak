@@ -14,6 +14,10 @@ FATE_LIBAVFORMAT-$(CONFIG_SRTP) += fate-srtp
 fate-srtp: libavformat/tests/srtp$(EXESUF)
 fate-srtp: CMD = run libavformat/tests/srtp$(EXESUF)
 
+FATE_LIBAVFORMAT-yes += fate-subtitles-seek
+fate-subtitles-seek: libavformat/tests/subtitles$(EXESUF)
+fate-subtitles-seek: CMD = run libavformat/tests/subtitles$(EXESUF)
+
 FATE_LIBAVFORMAT-yes += fate-url
 fate-url: libavformat/tests/url$(EXESUF)
 fate-url: CMD = run libavformat/tests/url$(EXESUF)
@@ -103,10 +103,26 @@ fate-sub-charenc: CMD = fmtstdout ass -sub_charenc cp1251 -i $(TARGET_SAMPLES)/s
 FATE_SUBTITLES-$(call DEMDEC, SCC, CCAPTION) += fate-sub-scc
 fate-sub-scc: CMD = fmtstdout ass -ss 57 -i $(TARGET_SAMPLES)/sub/witch.scc
 
+# the streaming mode must return the same packets as loading the whole file,
+# with a duplicated and an out of order event, and when seeking afterwards
+SUB_PROBE_SEEK = run ffprobe$(PROGSSUF)$(EXESUF) -show_packets -show_data_hash crc32 -print_format compact \
+                 -read_intervals "%+\#20,3%+\#2,8.6%+\#2,1%+\#1,11%+\#3"
+
+FATE_SUBTITLES_FFPROBE-$(CONFIG_SRT_DEMUXER) += fate-sub-srt-seek fate-sub-srt-streaming
+fate-sub-srt-seek: CMD = $(SUB_PROBE_SEEK) $(SRC_PATH)/tests/subtitles.srt
+fate-sub-srt-streaming: CMD = $(SUB_PROBE_SEEK) -streaming 1 $(SRC_PATH)/tests/subtitles.srt
+fate-sub-srt-streaming: REF = $(SRC_PATH)/tests/ref/fate/sub-srt-seek
+
+FATE_SUBTITLES_FFPROBE-$(CONFIG_WEBVTT_DEMUXER) += fate-sub-webvtt-seek fate-sub-webvtt-streaming
+fate-sub-webvtt-seek: CMD = $(SUB_PROBE_SEEK) $(SRC_PATH)/tests/subtitles.vtt
+fate-sub-webvtt-streaming: CMD = $(SUB_PROBE_SEEK) -streaming 1 $(SRC_PATH)/tests/subtitles.vtt
+fate-sub-webvtt-streaming: REF = $(SRC_PATH)/tests/ref/fate/sub-webvtt-seek
+
 FATE_SUBTITLES-$(call ENCMUX, ASS, ASS) += $(FATE_SUBTITLES_ASS-yes)
 FATE_SUBTITLES += $(FATE_SUBTITLES-yes)
+FATE_FFPROBE += $(FATE_SUBTITLES_FFPROBE-yes)
 
 fate-sub-%: CMP = rawdiff
 
 FATE_SAMPLES_FFMPEG += $(FATE_SUBTITLES)
-fate-subtitles: $(FATE_SUBTITLES)
+fate-subtitles: $(FATE_SUBTITLES) $(FATE_SUBTITLES_FFPROBE-yes)
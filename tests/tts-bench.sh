@@ -0,0 +1,153 @@
+#!/bin/sh
+#
+# Benchmark and regression check of the subtitle speech of ffmpeg against
+# tools/tts_mock_server, for each subtitle format and server latency.
+# Reports the throughput, the speech delay from the -tts_stats lines and
+# the peak RSS, and fails when a subtitle is not spoken.
+#
+# usage: tts-bench.sh ffmpeg tts_mock_server workdir
+#
+# TTS_BENCH_LATENCY   server latencies in milliseconds (default "0 100 300")
+# TTS_BENCH_DURATION  length of the program audio in seconds (default 120)
+# TTS_BENCH_FLAGS     extra ffmpeg options, e.g. "-tts_raw -tts_batch 4"
+#
+# It then checks that mono speech, which cannot be mixed into the stereo
+# program, is neither cached nor spilled to -tts_cache_dir, that fitted
+# speech keeps its timings, and that -tts_map works with a copied program.
+
+LC_ALL=C
+export LC_ALL
+
+ffmpeg="$1"
+server="$2"
+dir="$3"
+
+latencies=${TTS_BENCH_LATENCY:-"0 100 300"}
+duration=${TTS_BENCH_DURATION:-120}
+flags=${TTS_BENCH_FLAGS:-}
+
+test -x "$ffmpeg" && test -x "$server" && test -n "$dir" || {
+    echo "usage: $0 ffmpeg tts_mock_server workdir"
+    exit 1
+}
+mkdir -p "$dir" || exit 1
+
+# one cue of one second every two seconds, the ASS one with markup to strip
+cues=$((duration / 2 - 1))
+i=0
+: > "$dir/bench.srt"
+{
+    printf '[Script Info]\nScriptType: v4.00+\n\n[V4+ Styles]\n'
+    printf 'Format: Name, Fontname, Fontsize, PrimaryColour, SecondaryColour, OutlineColour, BackColour, Bold, Italic, Underline, StrikeOut, ScaleX, ScaleY, Spacing, Angle, BorderStyle, Outline, Shadow, Alignment, MarginL, MarginR, MarginV, Encoding\n'
+    printf 'Style: Default,Arial,20,&H00FFFFFF,&H00FFFFFF,&H00000000,&H00000000,0,0,0,0,100,100,0,0,1,1,0,2,10,10,10,0\n\n'
+    printf '[Events]\nFormat: Layer, Start, End, Style, Name, MarginL, MarginR, MarginV, Effect, Text\n'
+} > "$dir/bench.ass"
+while [ $i -lt $cues ]; do
+    s=$((i * 2 + 1))
+    printf '%d\n%02d:%02d:%02d,000 --> %02d:%02d:%02d,000\nLine %d, spoken\nover two rows\n\n' \
+        $((i + 1)) $((s / 3600)) $((s / 60 % 60)) $((s % 60)) \
+        $(((s + 1) / 3600)) $(((s + 1) / 60 % 60)) $(((s + 1) % 60)) $i >> "$dir/bench.srt"
+    printf 'Dialogue: 0,%d:%02d:%02d.00,%d:%02d:%02d.00,Default,,0,0,0,,{\\i1}Line %d{\\i0}, spoken\\Nover two rows\n' \
+        $((s / 3600)) $((s / 60 % 60)) $((s % 60)) \
+        $(((s + 1) / 3600)) $(((s + 1) / 60 % 60)) $(((s + 1) % 60)) $i >> "$dir/bench.ass"
+    i=$((i + 1))
+done
+
+"$ffmpeg" -nostdin -v error -f lavfi -i "sine=f=220:r=48000:d=$duration" -ac 2 -c:a pcm_s16le -y "$dir/bench.wav" ||
+    exit 1
+
+start_server(){
+    "$server" "$@" > "$dir/server.port" &
+    pid=$!
+    port=
+    while [ -z "$port" ] && kill -0 $pid 2>/dev/null; do
+        sleep 0.1
+        port=$(awk '{ print $2 }' "$dir/server.port")
+    done
+    if [ -z "$port" ]; then
+        echo "$server did not start"
+        exit 1
+    fi
+}
+
+printf '%-4s %8s %9s %28s %10s\n' subs latency speed "delay p50/p95/max ms" maxrss
+failed=0
+for latency in $latencies; do
+    start_server -l $latency
+
+    for subs in srt ass; do
+        rm -f "$dir/stats.jsonl"
+        "$ffmpeg" -nostdin -benchmark -tts_prefetch 10 -tts_endpoints 127.0.0.1:$port \
+            -tts_stats "$dir/stats.jsonl" $flags -i "$dir/bench.wav" -i "$dir/bench.$subs" \
+            -map 0:a -map 1 -c:a pcm_s16le -c:s ass -y "$dir/out.mkv" 2> "$dir/ffmpeg.log"
+        ret=$?
+
+        rtime=$(sed -n 's/^bench: utime=.* rtime=\([0-9.]*\)s$/\1/p' "$dir/ffmpeg.log")
+        maxrss=$(sed -n 's/^bench: maxrss=\([0-9]*\)kB$/\1/p' "$dir/ffmpeg.log")
+        spoken=$(grep -c '"samples":[1-9]' "$dir/stats.jsonl" 2>/dev/null)
+        delay=$(sed -n 's/.*"delay_us":\([0-9]*\).*/\1/p' "$dir/stats.jsonl" 2>/dev/null | sort -n |
+                awk '{ d[NR] = $1 } END { if (NR) printf "%.0f/%.0f/%.0f", d[int((NR + 1) / 2)] / 1000, d[int((NR * 95 + 99) / 100)] / 1000, d[NR] / 1000 }')
+
+        printf '%-4s %6sms %8sx %28s %8skB\n' $subs $latency \
+            $(awk "BEGIN { printf \"%.1f\", $duration / (${rtime:-0} + 0.000001) }") "$delay" "$maxrss"
+        if [ $ret -ne 0 ] || [ "${spoken:-0}" -ne $cues ]; then
+            echo "$subs at ${latency}ms: ffmpeg returned $ret, spoke ${spoken:-0} of $cues subtitles, see $dir/ffmpeg.log"
+            failed=1
+        fi
+    done
+
+    kill $pid
+    wait $pid 2>/dev/null
+done
+
+# a one entry cache evicts at every subtitle, none of which may reach the disk
+start_server -c 1
+rm -rf "$dir/cache"
+mkdir -p "$dir/cache"
+"$ffmpeg" -nostdin -tts_endpoints 127.0.0.1:$port -tts_cache_size 1 -tts_cache_dir "$dir/cache" \
+    $flags -i "$dir/bench.wav" -i "$dir/bench.srt" \
+    -map 0:a -map 1 -c:a pcm_s16le -c:s ass -y "$dir/out.mkv" 2> "$dir/ffmpeg.log"
+ret=$?
+spilled=$(ls "$dir/cache" | wc -l)
+if [ $ret -ne 0 ] || [ $spilled -ne 0 ]; then
+    echo "mono speech: ffmpeg returned $ret, spilled $spilled subtitles, see $dir/ffmpeg.log"
+    failed=1
+fi
+kill $pid
+wait $pid 2>/dev/null
+
+# speech longer than its cue is sped up, its placement and timings must survive that
+start_server -s 3
+rm -f "$dir/stats.jsonl"
+"$ffmpeg" -nostdin -tts_prefetch 10 -tts_endpoints 127.0.0.1:$port -tts_fit 2 -tts_stats "$dir/stats.jsonl" \
+    $flags -i "$dir/bench.wav" -i "$dir/bench.srt" \
+    -map 0:a -map 1 -c:a pcm_s16le -c:s ass -y "$dir/out.mkv" 2> "$dir/ffmpeg.log"
+ret=$?
+fitted=$(grep -c '"fit_us"' "$dir/stats.jsonl" 2>/dev/null)
+# the cues start at 1s, and a delay of 1000s or more is the raw clock
+lost=$(grep -c -e '"pts":0\.' -e '"delay_us":[0-9]\{10,\}' "$dir/stats.jsonl" 2>/dev/null)
+timed=$(grep -c '"request_us"' "$dir/stats.jsonl" 2>/dev/null)
+if [ $ret -ne 0 ] || [ "${fitted:-0}" -ne $cues ] || [ "${lost:-0}" -ne 0 ] || [ "${timed:-0}" -ne $cues ]; then
+    echo "fitted speech: ffmpeg returned $ret, fitted ${fitted:-0} of $cues subtitles, $lost without their timings, see $dir/ffmpeg.log"
+    failed=1
+fi
+kill $pid
+wait $pid 2>/dev/null
+
+# a -tts_map onto the stream feeding [tts] still speaks when that stream is copied
+start_server
+rm -f "$dir/stats.jsonl"
+"$ffmpeg" -nostdin -tts_prefetch 10 -tts_endpoints 127.0.0.1:$port -tts_stats "$dir/stats.jsonl" \
+    $flags -i "$dir/bench.wav" -i "$dir/bench.srt" -tts_map 1:s=0:a \
+    -filter_complex "[tts]anull[speech]" -map 0:a -map "[speech]" -map 1 -c:a:0 copy -c:a:1 pcm_s16le -c:s ass \
+    -y "$dir/out.mkv" 2> "$dir/ffmpeg.log"
+ret=$?
+spoken=$(grep -c '"samples":[1-9]' "$dir/stats.jsonl" 2>/dev/null)
+if [ $ret -ne 0 ] || [ "${spoken:-0}" -ne $cues ]; then
+    echo "copied program: ffmpeg returned $ret, spoke ${spoken:-0} of $cues subtitles, see $dir/ffmpeg.log"
+    failed=1
+fi
+kill $pid
+wait $pid 2>/dev/null
+
+exit $failed
@@ -0,0 +1,471 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Minimal subtitle tts server for testing and benchmarking the -tts_*
+ * options of ffmpeg. Every synthesis answers a 440 Hz tone as long as the
+ * subtitle, after an artificial latency, in the format asked by ffmpeg.
+ *
+ * POST <any path>      one JSON request, or a JSON array of them, answered
+ *                      with {"id":"N"} or {"ids":[...]}, or with the raw
+ *                      samples when "response_format" is "raw"
+ * GET  <any path>/N    the tone of the request N as a WAV file
+ *
+ * The listening port is printed on stdout once the server is ready. With -c
+ * the speech has that many channels whatever was asked, to test how ffmpeg
+ * handles speech it cannot mix.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "libavutil/common.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/mathematics.h"
+
+#define MAX_HEADER_SIZE (64 * 1024)
+#define MAX_BATCH 64
+
+typedef struct Speech {
+    int sample_rate;
+    int channels;
+    int bps;            /* bytes per sample of the raw answer */
+    int is_float;
+    double duration;
+} Speech;
+
+static double latency;  /* seconds before answering a synthesis */
+static double stretch = 1.0;
+static int force_channels; /* channels of every answer, 0 for those asked */
+
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static Speech *store;
+static int nb_store;
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-p port] [-l latency_ms] [-s stretch] [-c channels]\n", argv0);
+    fprintf(stderr, "  -p  port to listen on, 0 (default) picks a free one\n");
+    fprintf(stderr, "  -l  milliseconds waited before answering a synthesis\n");
+    fprintf(stderr, "  -s  speech duration relative to the subtitle duration (default 1.0)\n");
+    fprintf(stderr, "  -c  channels of the speech, 0 (default) for those asked\n");
+    return ret;
+}
+
+static int write_all(int fd, const void *buf, size_t size)
+{
+    const uint8_t *p = buf;
+
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p    += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int send_response(int fd, int code, const char *type, const void *body, size_t size)
+{
+    char header[256];
+    int len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+                       code, code == 200 ? "OK" : "Not Found", type, size);
+
+    if (write_all(fd, header, len) < 0)
+        return -1;
+    return size ? write_all(fd, body, size) : 0;
+}
+
+/* the string value of key in the JSON object between obj and end, escaped text cannot match the pattern */
+static int json_value(const char *obj, const char *end, const char *key, char *val, int val_size)
+{
+    char pattern[64];
+    const char *p, *stop;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+    for (p = obj; p < end; p++) {
+        if (!strncmp(p, pattern, strlen(pattern)))
+            break;
+    }
+    if (p >= end)
+        return -1;
+    p += strlen(pattern);
+    stop = memchr(p, '"', end - p);
+    if (!stop || stop - p >= val_size)
+        return -1;
+    memcpy(val, p, stop - p);
+    val[stop - p] = 0;
+    return 0;
+}
+
+static int layout_channels(const char *layout)
+{
+    static const struct { const char *name; int channels; } layouts[] = {
+        { "mono", 1 }, { "stereo", 2 }, { "2.1", 3 }, { "3.0", 3 }, { "quad", 4 },
+        { "4.0", 4 }, { "5.0", 5 }, { "5.1", 6 }, { "6.1", 7 }, { "7.1", 8 },
+    };
+    int i;
+
+    for (i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++)
+        if (!strncmp(layout, layouts[i].name, strlen(layouts[i].name)))
+            return layouts[i].channels;
+    return 2;
+}
+
+static void parse_speech(const char *obj, const char *end, Speech *s, int *raw)
+{
+    char val[64];
+
+    s->sample_rate = json_value(obj, end, "sample_rate", val, sizeof(val)) ? 48000 : atoi(val);
+    if (s->sample_rate <= 0)
+        s->sample_rate = 48000;
+    s->duration = json_value(obj, end, "duration", val, sizeof(val)) ? 1.0 : atof(val);
+    s->duration = fmax(s->duration, 0) * stretch;
+    s->channels = json_value(obj, end, "channel_layout", val, sizeof(val)) ? 2 : layout_channels(val);
+    if (force_channels > 0)
+        s->channels = force_channels;
+    s->bps      = 2;
+    s->is_float = 0;
+    if (!json_value(obj, end, "sample_fmt", val, sizeof(val))) {
+        if (!strcmp(val, "s32"))
+            s->bps = 4;
+        else if (!strcmp(val, "flt"))
+            s->bps = 4, s->is_float = 1;
+        else if (!strcmp(val, "dbl"))
+            s->bps = 8, s->is_float = 1;
+    }
+    *raw = !json_value(obj, end, "response_format", val, sizeof(val)) && !strcmp(val, "raw");
+}
+
+/* split the request body into its objects, skipping the braces inside strings */
+static int parse_request(const char *body, Speech *speech, int *raw)
+{
+    const char *obj = NULL, *p;
+    int in_string = 0, nb = 0;
+
+    for (p = body; *p && nb < MAX_BATCH; p++) {
+        if (in_string) {
+            if (*p == '\\' && p[1])
+                p++;
+            else if (*p == '"')
+                in_string = 0;
+        } else if (*p == '"') {
+            in_string = 1;
+        } else if (*p == '{') {
+            obj = p;
+        } else if (*p == '}' && obj) {
+            parse_speech(obj, p, &speech[nb++], raw);
+            obj = NULL;
+        }
+    }
+    return nb;
+}
+
+static uint8_t *make_samples(const Speech *s, int bps, int is_float, size_t *size)
+{
+    int nb_samples = lrint(s->duration * s->sample_rate);
+    uint8_t *buf, *p;
+    int i, ch;
+
+    *size = (size_t)nb_samples * s->channels * bps;
+    buf = p = malloc(*size ? *size : 1);
+    if (!buf)
+        return NULL;
+    for (i = 0; i < nb_samples; i++) {
+        double v = 0.25 * sin(2 * M_PI * 440 * i / s->sample_rate);
+        for (ch = 0; ch < s->channels; ch++) {
+            if (is_float && bps == 4) {
+                float f = v;
+                memcpy(p, &f, 4);
+            } else if (is_float) {
+                memcpy(p, &v, 8);
+            } else if (bps == 4) {
+                int32_t x = lrint(v * INT32_MAX);
+                memcpy(p, &x, 4);
+            } else {
+                int16_t x = lrint(v * INT16_MAX);
+                memcpy(p, &x, 2);
+            }
+            p += bps;
+        }
+    }
+    return buf;
+}
+
+static int answer_wav(int fd, const Speech *s)
+{
+    size_t size;
+    uint8_t *data = make_samples(s, 2, 0, &size);
+    uint8_t *wav;
+    int ret;
+
+    if (!data)
+        return -1;
+    wav = malloc(44 + size);
+    if (!wav) {
+        free(data);
+        return -1;
+    }
+    memcpy(wav, "RIFF", 4);
+    AV_WL32(wav + 4, 36 + size);
+    memcpy(wav + 8, "WAVEfmt ", 8);
+    AV_WL32(wav + 16, 16);
+    AV_WL16(wav + 20, 1);
+    AV_WL16(wav + 22, s->channels);
+    AV_WL32(wav + 24, s->sample_rate);
+    AV_WL32(wav + 28, s->sample_rate * s->channels * 2);
+    AV_WL16(wav + 32, s->channels * 2);
+    AV_WL16(wav + 34, 16);
+    memcpy(wav + 36, "data", 4);
+    AV_WL32(wav + 40, size);
+    memcpy(wav + 44, data, size);
+
+    ret = send_response(fd, 200, "audio/wav", wav, 44 + size);
+    free(data);
+    free(wav);
+    return ret;
+}
+
+static int answer_raw(int fd, const Speech *speech, int nb)
+{
+    uint8_t *out = NULL, *tmp;
+    size_t out_size = 0;
+    int i, ret;
+
+    /* a batch holds each segment after its 32 bit little endian byte count */
+    for (i = 0; i < nb; i++) {
+        size_t size;
+        uint8_t *data = make_samples(&speech[i], speech[i].bps, speech[i].is_float, &size);
+        if (!data || !(tmp = realloc(out, out_size + size + 4))) {
+            free(data);
+            free(out);
+            return -1;
+        }
+        out = tmp;
+        if (nb > 1) {
+            AV_WL32(out + out_size, size);
+            out_size += 4;
+        }
+        memcpy(out + out_size, data, size);
+        out_size += size;
+        free(data);
+    }
+    ret = send_response(fd, 200, "audio/x-raw", out, out_size);
+    free(out);
+    return ret;
+}
+
+static int answer_ids(int fd, const Speech *speech, int nb)
+{
+    char body[MAX_BATCH * 16 + 16];
+    Speech *tmp;
+    int len, first, i;
+
+    pthread_mutex_lock(&store_lock);
+    tmp = realloc(store, (nb_store + nb) * sizeof(*store));
+    if (!tmp) {
+        pthread_mutex_unlock(&store_lock);
+        return -1;
+    }
+    store = tmp;
+    first = nb_store;
+    memcpy(store + nb_store, speech, nb * sizeof(*speech));
+    nb_store += nb;
+    pthread_mutex_unlock(&store_lock);
+
+    if (nb == 1) {
+        len = snprintf(body, sizeof(body), "{\"id\":\"%d\"}", first);
+    } else {
+        len = snprintf(body, sizeof(body), "{\"ids\":[");
+        for (i = 0; i < nb; i++)
+            len += snprintf(body + len, sizeof(body) - len, "%s\"%d\"", i ? "," : "", first + i);
+        len += snprintf(body + len, sizeof(body) - len, "]}");
+    }
+    return send_response(fd, 200, "application/json", body, len);
+}
+
+static int answer_get(int fd, const char *path)
+{
+    const char *id = strrchr(path, '/');
+    Speech s;
+    int n;
+
+    n = id ? atoi(id + 1) : -1;
+    pthread_mutex_lock(&store_lock);
+    if (n < 0 || n >= nb_store) {
+        pthread_mutex_unlock(&store_lock);
+        return send_response(fd, 404, "text/plain", NULL, 0);
+    }
+    s = store[n];
+    pthread_mutex_unlock(&store_lock);
+
+    return answer_wav(fd, &s);
+}
+
+/* serve the keep-alive requests of one connection until it is closed */
+static void *serve(void *arg)
+{
+    int fd = (intptr_t)arg;
+    char *buf = malloc(MAX_HEADER_SIZE + 1);
+    int len = 0;
+
+    while (buf) {
+        char method[16], path[1024];
+        char *end, *body, *p;
+        long content_length = 0;
+        ssize_t n;
+        int header_size, ret;
+
+        buf[len] = 0;
+        if (!(end = strstr(buf, "\r\n\r\n"))) {
+            if (len >= MAX_HEADER_SIZE)
+                break;
+            n = recv(fd, buf + len, MAX_HEADER_SIZE - len, 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            len += n;
+            continue;
+        }
+        header_size = end + 4 - buf;
+        if (sscanf(buf, "%15s %1023s", method, path) != 2)
+            break;
+        for (p = buf; p < end; p = strstr(p, "\r\n") + 2) {
+            if (!strncasecmp(p, "Content-Length:", 15))
+                content_length = strtol(p + 15, NULL, 10);
+        }
+        if (content_length < 0 || content_length > 64 * 1024 * 1024)
+            break;
+
+        body = malloc(content_length + 1);
+        if (!body)
+            break;
+        n = FFMIN(len - header_size, content_length);
+        memcpy(body, buf + header_size, n);
+        while (n < content_length) {
+            ssize_t r = recv(fd, body + n, content_length - n, 0);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                break;
+            n += r;
+        }
+        body[n] = 0;
+        if (n < content_length) {
+            free(body);
+            break;
+        }
+        /* keep what was read past this request */
+        n = FFMAX(len - header_size - content_length, 0);
+        memmove(buf, buf + header_size + content_length, n);
+        len = n;
+
+        if (!strcmp(method, "POST")) {
+            Speech speech[MAX_BATCH];
+            int raw = 0, nb = parse_request(body, speech, &raw);
+            if (latency > 0)
+                usleep(latency * 1000000);
+            if (!nb)
+                ret = send_response(fd, 404, "text/plain", NULL, 0);
+            else if (raw)
+                ret = answer_raw(fd, speech, nb);
+            else
+                ret = answer_ids(fd, speech, nb);
+        } else {
+            ret = answer_get(fd, path);
+        }
+        free(body);
+        if (ret < 0)
+            break;
+    }
+
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in addr = { 0 };
+    socklen_t addr_len = sizeof(addr);
+    int port = 0, fd, opt, one = 1;
+
+    while ((opt = getopt(argc, argv, "p:l:s:c:h")) != -1) {
+        switch (opt) {
+        case 'p': port    = atoi(optarg);          break;
+        case 'l': latency = atof(optarg) / 1000.0; break;
+        case 's': stretch = atof(optarg);          break;
+        case 'c': force_channels = atoi(optarg);   break;
+        case 'h': return usage(argv[0], 0);
+        default:  return usage(argv[0], 1);
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return 1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+        perror("bind");
+        return 1;
+    }
+    printf("port %d\n", ntohs(addr.sin_port));
+    fflush(stdout);
+
+    for (;;) {
+        pthread_t thread;
+        int client = accept(fd, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            return 1;
+        }
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (pthread_create(&thread, NULL, serve, (void *)(intptr_t)client)) {
+            close(client);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}